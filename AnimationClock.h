@@ -0,0 +1,125 @@
+#ifndef __ANIMATION_CLOCK__H
+#define __ANIMATION_CLOCK__H
+#include <OverAnimate.h>
+#include <esp_timer.h>
+#include <atomic>
+#include "BeatDetector.h"
+
+// A time base the animation clock can follow. now() is only called from the render task.
+class ClockMaster
+{
+public:
+    virtual ~ClockMaster() {}
+    virtual TimeInterval now() = 0;
+    // True if other cores can be following the same time, so that layers should be
+    // wherever this time puts them rather than carrying on from where they were.
+    virtual bool shared() { return false; }
+};
+
+// Seconds since boot, from the microsecond timer.
+class WallClockMaster : public ClockMaster
+{
+public:
+    virtual TimeInterval now()
+    {
+        return esp_timer_get_time() / 1000000.0;
+    }
+};
+
+// Seconds on a clock shared between cores: the wall clock plus an offset that the mesh
+// clock sync keeps adjusting. Until something sets it, it runs in step with the wall clock.
+class MeshClockMaster : public ClockMaster
+{
+public:
+    MeshClockMaster() : _offsetMicros(0) {}
+
+    void setOffset(int64_t micros) { _offsetMicros = micros; }
+
+    virtual TimeInterval now()
+    {
+        return (esp_timer_get_time() + _offsetMicros) / 1000000.0;
+    }
+    virtual bool shared() { return true; }
+private:
+    std::atomic<int64_t> _offsetMicros;
+};
+
+// Beats of the music, so that a layer with speed 1 runs one cycle per beat. The fraction
+// follows the beat detector's phase; without a steady beat, it keeps counting at the last
+// known tempo (or 120 bpm) so animations don't stop between songs.
+class BeatClockMaster : public ClockMaster
+{
+public:
+    BeatClockMaster(BeatDetector &beats) : _detector(beats), _beats(0), _beatsPerSecond(2), _lastWall(-1) {}
+
+    virtual TimeInterval now()
+    {
+        TimeInterval wall = _wall.now();
+        TimeInterval elapsed = _lastWall < 0 ? 0 : wall - _lastWall;
+        _lastWall = wall;
+
+        // One consistent copy of what the detector's task last published
+        const BeatDetector::State &beat = _detector.publishedState();
+        float bpm = beat.bpm();
+        if(bpm == 0)
+        {
+            _beats += elapsed * _beatsPerSecond;
+            return _beats;
+        }
+        _beatsPerSecond = bpm / 60.0;
+
+        // The detector's phase gets nudged, so only take it as a target near where we
+        // are, and never go backwards.
+        TimeInterval target = floor(_beats) + beat.phaseAt(micros());
+        if(target < _beats - 0.5) target += 1;
+        else if(target > _beats + 0.5) target -= 1;
+        _beats = std::max(_beats, target);
+        return _beats;
+    }
+    // Cores count beats from different starting points, but every one of them lands on
+    // the music's beat, so layers at whole-beat speeds line up
+    virtual bool shared() { return true; }
+private:
+    BeatDetector &_detector;
+    WallClockMaster _wall;
+    TimeInterval _beats;
+    TimeInterval _beatsPerSecond;
+    TimeInterval _lastWall;
+};
+
+// The one clock every layer animates from. It's sampled once per frame so all layers see
+// the same instant. A shared master's time is used as it is, so every core following it
+// agrees (smoothing out corrections is ClockSync's job). The wall clock is only ours, so
+// switching to it keeps things continuous instead: it picks up where the old master left
+// off.
+class AnimationClock
+{
+public:
+    AnimationClock() : _master(NULL), _offset(0), _now(0) {}
+
+    void tick(ClockMaster *master)
+    {
+        TimeInterval masterNow = master->now();
+        if(master->shared())
+        {
+            _offset = 0;
+        }
+        else if(master != _master)
+        {
+            _offset = _now - masterNow;
+        }
+        _master = master;
+        _now = masterNow + _offset;
+    }
+
+    // Master time: seconds, or beats when following the beat.
+    TimeInterval now() const { return _now; }
+    // Whether the current master is shared with other cores; see ClockMaster::shared()
+    bool shared() const { return _master && _master->shared(); }
+private:
+    ClockMaster *_master;
+    TimeInterval _offset;
+    TimeInterval _now;
+};
+
+#endif
@@ -1,27 +1,13 @@
 #include "Animations.h"
 #include "Util.h"
 
-// Simple hash for deterministic pseudo-random based on position/time
-// Allows "random" effects to be stateless
-static inline uint32_t hash(uint32_t x) {
-    x = ((x >> 16) ^ x) * 0x45d9f3b;
-    x = ((x >> 16) ^ x) * 0x45d9f3b;
-    x = (x >> 16) ^ x;
-    return x;
-}
-
-// Returns pseudo-random float 0-1 for a given seed
-static inline float hashFloat(uint32_t seed) {
-    return (hash(seed) & 0xFFFF) / 65535.0f;
-}
-
 void NothingAnim(LayerAnimation *self, TimeInterval t)
 {
 }
 
 void OpposingWavesAnim(LayerAnimation *self, TimeInterval t)
 {
-    SubStrip *strip = self->backbuffer;
+    SubStrip *strip = &self->canvas;
     ShinyLayerSettings *prefs = self->prefs;
     for(int i = 0; i < strip->numPixels(); i++)
     {
@@ -32,7 +18,7 @@ void OpposingWavesAnim(LayerAnimation *self, TimeInterval t)
 // tau is waveform length, and phi is phase offset
 void SingleWaveAnim(LayerAnimation *self, TimeInterval t)
 {
-    SubStrip *strip = self->backbuffer;
+    SubStrip *strip = &self->canvas;
     ShinyLayerSettings *prefs = self->prefs;
     for(int i = 0; i < strip->numPixels(); i++)
     {
@@ -43,7 +29,7 @@ void SingleWaveAnim(LayerAnimation *self, TimeInterval t)
 // simple fade between two colors
 void BreatheAnim(LayerAnimation *self, TimeInterval t)
 {
-    SubStrip *strip = self->backbuffer;
+    SubStrip *strip = &self->canvas;
     ShinyLayerSettings *prefs = self->prefs;
     for(int i = 0; i < strip->numPixels(); i++)
     {
@@ -56,7 +42,7 @@ void BreatheAnim(LayerAnimation *self, TimeInterval t)
 // phi controls animation speed multiplier
 void RainbowAnim(LayerAnimation *self, TimeInterval t)
 {
-    SubStrip *strip = self->backbuffer;
+    SubStrip *strip = &self->canvas;
     ShinyLayerSettings *prefs = self->prefs;
     int numPixels = strip->numPixels();
     
@@ -81,7 +67,7 @@ void RainbowAnim(LayerAnimation *self, TimeInterval t)
 // phi controls comet width
 void CometAnim(LayerAnimation *self, TimeInterval t)
 {
-    SubStrip *strip = self->backbuffer;
+    SubStrip *strip = &self->canvas;
     ShinyLayerSettings *prefs = self->prefs;
     int numPixels = strip->numPixels();
     
@@ -113,7 +99,7 @@ void CometAnim(LayerAnimation *self, TimeInterval t)
 // phi controls how much the scanner "bleeds" (glow width)
 void ScannerAnim(LayerAnimation *self, TimeInterval t)
 {
-    SubStrip *strip = self->backbuffer;
+    SubStrip *strip = &self->canvas;
     ShinyLayerSettings *prefs = self->prefs;
     int numPixels = strip->numPixels();
     
@@ -143,33 +129,27 @@ void ScannerAnim(LayerAnimation *self, TimeInterval t)
 // phi controls twinkle speed
 void TwinkleAnim(LayerAnimation *self, TimeInterval t)
 {
-    SubStrip *strip = self->backbuffer;
+    SubStrip *strip = &self->canvas;
     ShinyLayerSettings *prefs = self->prefs;
     int numPixels = strip->numPixels();
     
     float density = prefs->p_tau / 10.0f; // 0-1 ish
     float speed = prefs->p_phi;
     
-    for(int i = 0; i < numPixels; i++)
+    // Only stars are drawn; the rest of the canvas is already black
+    for(const TwinkleStar &star : self->twinkleTable.stars(numPixels, density))
     {
-        // Each pixel gets its own "random" phase and frequency
-        float phase = hashFloat(i * 12345);
-        float freq = 0.5f + hashFloat(i * 67890) * speed;
-        
-        // Determine if this pixel is a "star" based on density
-        float starChance = hashFloat(i * 11111);
-        if(starChance > density) {
-            strip->set(i, CRGB::Black);
-            continue;
-        }
+        // Each star gets its own "random" phase and frequency
+        float phase = star.phase / 65535.0f;
+        float freq = 0.5f + star.freq / 65535.0f * speed;
         
         // Twinkle using sine wave with per-pixel phase
         float brightness = curve(t * freq + phase);
         brightness = brightness * brightness; // sharper twinkle
         
         // Alternate between primary and secondary color based on position
-        CRGB color = (hash(i) & 1) ? prefs->mainColor : prefs->secondaryColor;
-        strip->set(i, color * brightness);
+        CRGB color = star.main ? prefs->mainColor : prefs->secondaryColor;
+        strip->set(star.index, color * brightness);
     }
 }
 
@@ -178,7 +158,7 @@ void TwinkleAnim(LayerAnimation *self, TimeInterval t)
 // phi controls group size (how many lit in a row)
 void TheaterChaseAnim(LayerAnimation *self, TimeInterval t)
 {
-    SubStrip *strip = self->backbuffer;
+    SubStrip *strip = &self->canvas;
     ShinyLayerSettings *prefs = self->prefs;
     int numPixels = strip->numPixels();
     
@@ -206,7 +186,7 @@ void TheaterChaseAnim(LayerAnimation *self, TimeInterval t)
 // phi controls pause time at full/empty
 void ColorWipeAnim(LayerAnimation *self, TimeInterval t)
 {
-    SubStrip *strip = self->backbuffer;
+    SubStrip *strip = &self->canvas;
     ShinyLayerSettings *prefs = self->prefs;
     int numPixels = strip->numPixels();
     
@@ -250,7 +230,7 @@ void ColorWipeAnim(LayerAnimation *self, TimeInterval t)
 // phi controls number of gradient cycles on strip
 void GradientPulseAnim(LayerAnimation *self, TimeInterval t)
 {
-    SubStrip *strip = self->backbuffer;
+    SubStrip *strip = &self->canvas;
     ShinyLayerSettings *prefs = self->prefs;
     int numPixels = strip->numPixels();
     
@@ -278,7 +258,7 @@ void GradientPulseAnim(LayerAnimation *self, TimeInterval t)
 // phi controls flash density
 void SparkleAnim(LayerAnimation *self, TimeInterval t)
 {
-    SubStrip *strip = self->backbuffer;
+    SubStrip *strip = &self->canvas;
     ShinyLayerSettings *prefs = self->prefs;
     int numPixels = strip->numPixels();
     
@@ -287,40 +267,107 @@ void SparkleAnim(LayerAnimation *self, TimeInterval t)
     
     // Background color (dim version of secondary)
     CRGB bgColor = prefs->secondaryColor * 0.1f;
+    strip->fill(bgColor);
     
-    for(int i = 0; i < numPixels; i++)
-    {
-        // Divide time into slots, check if this pixel sparkles in current/recent slots
-        float brightness = 0;
-        
-        // Check a few time slots for sparkles
-        for(int slot = 0; slot < 3; slot++) {
-            int timeSlot = (int)(t / flashDuration) - slot;
-            uint32_t seed = hash(i * 99999 + timeSlot);
-            float chance = (seed & 0xFFFF) / 65535.0f;
-            
-            if(chance < density) {
-                // This pixel sparkles in this slot
-                float slotStart = timeSlot * flashDuration;
-                float slotProgress = (t - slotStart) / flashDuration;
-                if(slotProgress >= 0 && slotProgress < 1.0f) {
-                    // Fade in then out
-                    float flash = (slotProgress < 0.5f) 
-                        ? (slotProgress * 2.0f) 
-                        : (2.0f - slotProgress * 2.0f);
-                    brightness = std::max(brightness, flash);
-                }
+    // Divide time into slots; pixels sparkle in the current or recent slots
+    int slotCount = 0;
+    int timeSlots[3];
+    float flashes[3];
+    for(int slot = 0; slot < 3; slot++) {
+        int timeSlot = (int)(t / flashDuration) - slot;
+        float slotStart = timeSlot * flashDuration;
+        float slotProgress = (t - slotStart) / flashDuration;
+        if(slotProgress >= 0 && slotProgress < 1.0f) {
+            // Fade in then out
+            float flash = (slotProgress < 0.5f) 
+                ? (slotProgress * 2.0f) 
+                : (2.0f - slotProgress * 2.0f);
+            if(flash > 0) {
+                timeSlots[slotCount] = timeSlot;
+                flashes[slotCount] = flash;
+                slotCount++;
             }
         }
-        
-        if(brightness > 0) {
-            strip->set(i, prefs->mainColor * brightness);
-        } else {
-            strip->set(i, bgColor);
+    }
+    sortSparkleSlots(timeSlots, flashes, slotCount);
+    
+    // Brightest slot last, so a pixel sparkling in several shows the brightest flash
+    for(int slot = 0; slot < slotCount; slot++) {
+        CRGB color = prefs->mainColor * flashes[slot];
+        for(uint16_t i : self->sparkleTable.flashes(timeSlots[slot], numPixels, density)) {
+            strip->set(i, color);
         }
     }
 }
 
+// Neighbours: our own primary color and those of every shinercore we're connected to, as
+// a gradient that scrolls along the strip by one color per cycle.
+// tau controls how many pixels each color spans
+// Integer-only per pixel, so it serves as its own fixed-point version.
+void NeighboursAnim(LayerAnimation *self, TimeInterval t)
+{
+    SubStrip *strip = &self->canvas;
+    ShinyLayerSettings *prefs = self->prefs;
+    int numPixels = strip->numPixels();
+
+    CRGB palette[MAX_NEIGHBOURS + 1];
+    int count = 1;
+    palette[0] = prefs->mainColor;
+    if(self->neighbours)
+    {
+        for(int i = 0; i < self->neighbours->count; i++) palette[count++] = self->neighbours->colors[i];
+    }
+
+    // Position along the palette, in 1/65536ths of a color
+    uint32_t length = (uint32_t)count << 16;
+    uint32_t step = (uint32_t)(65536.0f / std::max(1.0f, fabsf(prefs->p_tau)));
+    uint32_t position = (uint32_t)((t / count - floor(t / count)) * length) % length;
+
+    for(int i = 0; i < numPixels; i++)
+    {
+        int index = position >> 16;
+        CRGB from = palette[index];
+        CRGB to = palette[index + 1 < count ? index + 1 : 0];
+        strip->set(i, from.lerp8(to, (position >> 8) & 0xFF));
+
+        position += step;
+        while(position >= length) position -= length;
+    }
+}
+
+// Frame keys: see AnimationFrameKeyFunc. Most animations move continuously, so t is the key.
+double TimeFrameKey(LayerAnimation *self, TimeInterval t)
+{
+    return t;
+}
+
+double NothingFrameKey(LayerAnimation *self, TimeInterval t)
+{
+    return 0;
+}
+
+// phi is the speed; at zero the rainbow stands still
+double RainbowFrameKey(LayerAnimation *self, TimeInterval t)
+{
+    return self->prefs->p_phi == 0 ? 0 : t;
+}
+
+// Only moves when the integer offset does
+double TheaterChaseFrameKey(LayerAnimation *self, TimeInterval t)
+{
+    int spacing = std::max(2, (int)self->prefs->p_tau);
+    return (int)(t * spacing * 2) % spacing;
+}
+
+// The two pauses are solid fills; t is never negative, so -1/-2 can't collide with it.
+double ColorWipeFrameKey(LayerAnimation *self, TimeInterval t)
+{
+    float phase = fmod(t / (self->prefs->p_tau / 10.0f + 0.5f), 4.0f);
+    if(phase >= 1.0f && phase < 2.0f) return -1;
+    if(phase >= 3.0f) return -2;
+    return t;
+}
+
 extern std::vector<String> animationNames = {
     "Nothing",
     "Opposing Waves",
@@ -334,6 +381,7 @@ extern std::vector<String> animationNames = {
     "Color Wipe",
     "Gradient Pulse",
     "Sparkle",
+    "Neighbours",
 };
 std::vector<AnimateLayerFunc> animationFuncs = {
     NothingAnim,
@@ -348,4 +396,20 @@ std::vector<AnimateLayerFunc> animationFuncs = {
     ColorWipeAnim,
     GradientPulseAnim,
     SparkleAnim,
+    NeighboursAnim,
+};
+std::vector<AnimationFrameKeyFunc> animationFrameKeys = {
+    NothingFrameKey,
+    TimeFrameKey,
+    TimeFrameKey,
+    TimeFrameKey,
+    RainbowFrameKey,
+    TimeFrameKey,
+    TimeFrameKey,
+    TimeFrameKey,
+    TheaterChaseFrameKey,
+    ColorWipeFrameKey,
+    TimeFrameKey,
+    TimeFrameKey,
+    TimeFrameKey,
 };
@@ -4,5 +4,9 @@
 
 extern std::vector<String> animationNames;
 extern std::vector<AnimateLayerFunc> animationFuncs;
+// Same animations, same order, computed in fixed point. See FixedAnimations.cpp.
+extern std::vector<AnimateLayerFunc> fixedAnimationFuncs;
+// Same order again; shared by both kernel sets since they draw the same frames.
+extern std::vector<AnimationFrameKeyFunc> animationFrameKeys;
 
 #endif
\ No newline at end of file
@@ -9,46 +9,180 @@
 // * Using Unified: https://github.com/m5stack/M5Unified/blob/master/examples/Basic/Microphone/Microphone.ino
 
 
+#ifndef __BEAT_DETECTOR__H
+#define __BEAT_DETECTOR__H
+#include "Fft.h"
+#include "Snapshot.h"
+#include <math.h>
+
 /// Opens microphone if available, and detects the beat of any playing music using FFT.
+///
+/// Audio is analyzed in overlapping windows: every hop, the window's spectrum is split
+/// into bands, and the rise in each band's log energy since the previous hop (spectral
+/// flux) is summed into an onset strength. Peaks in onset strength are onsets. The tempo
+/// comes from autocorrelating the last few seconds of onset strength, and the beat phase
+/// from a free-running beat clock that onsets nudge into line.
 class BeatDetector
 {
 public:
   BeatDetector() 
-    : _isOnBeat(false), data_offset(0)
-  {}
+    : _writePos(0), _buffered(0), uses_echo(false), _isOnBeat(false),
+      _hops(0), _onsetCount(0), _prevOnset(0), _prevPrevOnset(0),
+      _period(0), _candidatePeriod(0), _phase(0), _lastHopMicros(0), _worstHopMicros(0)
+  {
+    memset(_bandLevels, 0, sizeof(_bandLevels));
+    memset(_onsets, 0, sizeof(_onsets));
+  }
 
   void setup()
   {
     uses_echo = OpenEchoMic();
     logger.print("Beat detector using echo mic? ");
     logger.println(uses_echo);
+
+    fftSetup();
+    for(int i = 0; i < kWindow; i++)
+    {
+      _window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / kWindow);
+    }
   }
 
   void update()
   {
-    if(uses_echo)
-    {
-      ReadEcho();
-    }
-    static const int third_of_a_second_in_samples = 1000; // figure out
-    if(data_offset > third_of_a_second_in_samples)
+    if(!uses_echo) return;
+
+    // Alternate between draining the DMA buffers into the ring and analyzing every complete
+    // window in it, until the DMA buffers are empty. If we're called too rarely, the I2S
+    // driver drops the oldest audio rather than us falling behind.
+    for(;;)
     {
-      AnalyzeAudio();
-      data_offset = 0;
+      int wanted = ReadEcho();
+
+      while(_buffered >= kWindowBytes)
+      {
+        // Samples still waiting after this window; tells us how long ago the window ended
+        int pendingSamples = (_buffered - kWindowBytes) / 2;
+        int windowStart = ((_writePos - _buffered + kRingBytes) % kRingBytes) / 2;
+        unsigned long start = micros();
+        AnalyzeAudio(windowStart, start - pendingSamples * 1000000ULL / kSampleRate);
+        _worstHopMicros = std::max(_worstHopMicros, micros() - start);
+
+        _buffered -= kHopBytes;
+      }
+
+      if(wanted > 0) break;
     }
   }
 
+  // False on devices without a microphone we know how to open
+  bool isListening()
+  {
+    return uses_echo;
+  }
+
+  // True during the first part of each beat, once a tempo has been found.
   bool isOnBeat()
   {
     return _isOnBeat;
   }
+
+  // The beat clock as of one analyzed hop
+  struct State
+  {
+    float period; // hops per beat, 0 when unknown
+    float phase; // beats since the last beat, at hopMicros
+    unsigned long hopMicros;
+    State(float period = 0, float phase = 0, unsigned long hopMicros = 0)
+      : period(period), phase(phase), hopMicros(hopMicros) {}
+
+    // How far into the current beat we are at time now, 0 to 1. Stays at 0 until a tempo
+    // has been found.
+    float phaseAt(unsigned long now) const
+    {
+      if(period == 0) return 0;
+      float hops = (now - hopMicros) / (1000000.0f / kHopRate);
+      float beats = phase + hops / period;
+      return beats - floorf(beats);
+    }
+
+    // Detected tempo in beats per minute, or 0 if there's no steady beat.
+    float bpm() const
+    {
+      return period == 0 ? 0 : 60.0f * kHopRate / period;
+    }
+  };
+
+  // From the task that calls update()
+  float beatPhase() { return state().phaseAt(micros()); }
+  float bpm() { return state().bpm(); }
+
+  // The state as of the last hop, for one other task (the render task's beat clock):
+  // update() publishes a copy every hop, so the fields read here always belong together.
+  // It stays intact until the next call.
+  const State &publishedState()
+  {
+    return _published.read();
+  }
+
+  // Longest time a single hop took to analyze since the last call.
+  unsigned long takeWorstHopMicros()
+  {
+    unsigned long worst = _worstHopMicros;
+    _worstHopMicros = 0;
+    return worst;
+  }
 private:
-  uint8_t micdata[1024 * 80];
-  int data_offset;
+  static const int kSampleRate = 16000;
+  static const int kWindow = 512; // 32 ms
+  static const int kHop = 256; // 16 ms
+  static constexpr float kHopRate = (float)kSampleRate / kHop;
+  static const int kWindowBytes = kWindow * 2;
+  static const int kHopBytes = kHop * 2;
+  // Exactly one window plus the hop being read in while the window waits for analysis
+  static const int kRingSamples = kWindow + kHop;
+  static const int kRingBytes = kRingSamples * 2;
+
+  static const int kBandCount = 7;
+
+  // Onset strength history for tempo estimation, about 6 seconds
+  static const int kOnsetHistory = 384;
+  // Beat periods considered, in hops: 187 down to 60 bpm
+  static const int kMinPeriod = 20;
+  static const int kMaxPeriod = 63;
+  // Tempo is re-estimated twice a second
+  static const int kTempoInterval = 31;
+  static constexpr float kOnBeatWidth = 0.15f;
+
+  // Ring buffer that i2s_read writes straight into; _buffered bytes before _writePos
+  // haven't been analyzed yet
+  int16_t micdata[kRingSamples];
+  int _writePos;
+  int _buffered;
   bool uses_echo;
 
   bool _isOnBeat;
 
+  float _window[kWindow];
+  float _fftData[kWindow * 2];
+  float _bandLevels[kBandCount];
+
+  float _onsets[kOnsetHistory]; // ring, newest at (_hops-1) % kOnsetHistory
+  uint32_t _hops;
+  int _onsetCount;
+  float _prevOnset, _prevPrevOnset;
+
+  float _period; // hops per beat, 0 when unknown
+  float _candidatePeriod;
+  float _phase; // beats since the last beat, at _lastHopMicros
+  unsigned long _lastHopMicros;
+  unsigned long _worstHopMicros;
+  Snapshot<State> _published;
+
+  State state() const
+  {
+    return State(_period, _phase, _lastHopMicros);
+  }
+
   // The mic on an M5Atom Echo is bolted onto basically an M5StickC.
   // Not sure if this code will also work on an M5StickC; if not, we can use M5.Microphone there instead.
   bool OpenEchoMic()
@@ -88,18 +222,187 @@ private:
     return err == ESP_OK;
   }
 
-  bool ReadEcho()
+  // Reads whatever the DMA buffers hold into the ring's free space, without waiting for
+  // more. Returns how many more bytes the ring could have taken: 0 means there may be
+  // more to read once some of the ring has been analyzed.
+  int ReadEcho()
   {
-    size_t bytes_read;
-    i2s_read(SPEAKER_I2S_NUMBER, (char *)(micdata + data_offset), 1024, &bytes_read, (100 / portTICK_RATE_MS));
-    data_offset += 1024;
+    // i2s_read can't wrap, so fill up to the end of the ring first, then from the start
+    while(_buffered < kRingBytes)
+    {
+      int wanted = std::min(kRingBytes - _buffered, kRingBytes - _writePos);
+      size_t bytes_read = 0;
+      i2s_read(SPEAKER_I2S_NUMBER, (char *)micdata + _writePos, wanted, &bytes_read, 0);
+      _writePos = (_writePos + bytes_read) % kRingBytes;
+      _buffered += bytes_read;
+      if((int)bytes_read < wanted) return wanted - bytes_read;
+    }
+    return 0;
+  }
 
-    // ?? do we read until bytes_read is less than 1024, or how do we know how much we got?
+  // Analyzes the window of samples that starts at the given ring index and ends at the
+  // given time.
+  void AnalyzeAudio(int start, unsigned long endMicros)
+  {
+    for(int i = 0; i < kWindow; i++)
+    {
+      _fftData[2*i] = micdata[(start + i) % kRingSamples] * _window[i];
+      _fftData[2*i+1] = 0;
+    }
+    fft(_fftData, kWindow);
+
+    // Band edges as FFT bins (31.25 Hz each): kick, bass, low mids ... up to 8 kHz
+    static const int kBandEdges[kBandCount + 1] = {1, 4, 10, 24, 48, 96, 160, 256};
+
+    float onset = 0;
+    for(int band = 0; band < kBandCount; band++)
+    {
+      float energy = 0;
+      for(int bin = kBandEdges[band]; bin < kBandEdges[band+1]; bin++)
+      {
+        energy += _fftData[2*bin] * _fftData[2*bin] + _fftData[2*bin+1] * _fftData[2*bin+1];
+      }
+      // Log energy, so a band's flux is about relative change and loud bands don't dominate
+      float level = logf(1.0f + energy / (kBandEdges[band+1] - kBandEdges[band]) * 1e-6f);
+      onset += std::max(0.0f, level - _bandLevels[band]);
+      _bandLevels[band] = level;
+    }
+
+    _onsets[_hops % kOnsetHistory] = onset;
+    _hops++;
+    _onsetCount = std::min(_onsetCount + 1, kOnsetHistory);
+
+    // The previous hop was an onset if it peaked well above the recent average
+    float average = 0;
+    for(int i = 1; i <= 16 && i <= _onsetCount; i++)
+    {
+      average += _onsets[(_hops - i) % kOnsetHistory];
+    }
+    average /= std::min(16, _onsetCount);
+    bool wasOnset = _prevOnset > _prevPrevOnset && _prevOnset >= onset && _prevOnset > average * 1.5f + 0.01f;
+    _prevPrevOnset = _prevOnset;
+    _prevOnset = onset;
+
+    if(_hops % kTempoInterval == 0 && _onsetCount == kOnsetHistory)
+    {
+      EstimateTempo();
+    }
+    TrackPhase(wasOnset, endMicros);
+  }
+
+  void EstimateTempo()
+  {
+    float mean = 0;
+    for(int i = 0; i < kOnsetHistory; i++) mean += _onsets[i];
+    mean /= kOnsetHistory;
+
+    float centered[kOnsetHistory];
+    for(int i = 0; i < kOnsetHistory; i++)
+    {
+      centered[i] = _onsets[(_hops + i) % kOnsetHistory] - mean;
+    }
+
+    float energy = 0;
+    for(int i = 0; i < kOnsetHistory; i++) energy += centered[i] * centered[i];
+    if(energy <= 0) return;
+
+    // Autocorrelation, weighted towards ~120 bpm so we don't lock onto half or double time
+    float scores[kMaxPeriod + 2] = {0};
+    int best = 0;
+    for(int lag = kMinPeriod - 1; lag <= kMaxPeriod + 1; lag++)
+    {
+      float sum = 0;
+      for(int i = lag; i < kOnsetHistory; i++) sum += centered[i] * centered[i - lag];
+      float octaves = log2f(lag / (kHopRate / 2.0f));
+      scores[lag] = sum / energy * expf(-0.5f * octaves * octaves);
+      if(lag >= kMinPeriod && lag <= kMaxPeriod && (best == 0 || scores[lag] > scores[best])) best = lag;
+    }
+
+    if(scores[best] < 0.1f)
+    {
+      _period = 0; // nothing periodic enough to call a beat
+      _candidatePeriod = 0;
+      return;
+    }
+
+    // Parabolic interpolation between neighbouring lags
+    float a = scores[best-1], b = scores[best], c = scores[best+1];
+    float denominator = a - 2*b + c;
+    float period = best + (denominator != 0 ? 0.5f * (a - c) / denominator : 0);
+
+    if(_period != 0 && fabsf(period - _period) < _period * 0.05f)
+    {
+      _period += (period - _period) * 0.25f;
+    }
+    else if(_candidatePeriod != 0 && fabsf(period - _candidatePeriod) < _candidatePeriod * 0.05f)
+    {
+      // Only switch tempo once the new one has shown up twice in a row
+      _period = period;
+      _candidatePeriod = 0;
+    }
+    else
+    {
+      _candidatePeriod = period;
+      return;
+    }
+
+    AlignPhase();
   }
 
-  void AnalyzeAudio()
+  // Finds where the beats fall in the onset history, and moves the beat clock towards it.
+  // Individual onsets only fine-tune the phase; this is what finds it in the first place,
+  // and keeps offbeat hits from dragging it half a beat off.
+  void AlignPhase()
   {
-    // ...
+    int bestOffset = 0;
+    float bestScore = -1;
+    for(int offset = 0; offset < (int)ceilf(_period); offset++)
+    {
+      float score = 0;
+      for(float age = offset; age < kOnsetHistory; age += _period)
+      {
+        score += _onsets[(_hops - 1 - (int)(age + 0.5f)) % kOnsetHistory];
+      }
+      if(score > bestScore)
+      {
+        bestScore = score;
+        bestOffset = offset;
+      }
+    }
+
+    // An onset peaks when the hit is in the middle of the window, a hop before its end;
+    // TrackPhase() advancing the clock by a hop right after this makes up for that.
+    float phase = bestOffset / _period;
+    float error = phase - _phase;
+    error -= roundf(error);
+    _phase += error * 0.5f;
+    _phase -= floorf(_phase);
+  }
+
+  void TrackPhase(bool wasOnset, unsigned long endMicros)
+  {
+    _lastHopMicros = endMicros;
+    if(_period == 0)
+    {
+      _phase = 0;
+      _isOnBeat = false;
+      _published.publish(state());
+      return;
+    }
+
+    _phase += 1.0f / _period;
+    if(wasOnset)
+    {
+      // The onset peaked a hop ago, so the hit was two hops ago; pull the beat clock part
+      // of the way towards it, unless it's too far off the beat to be one
+      float onsetPhase = _phase - 2.0f / _period;
+      float error = onsetPhase - roundf(onsetPhase);
+      if(fabsf(error) < 0.2f) _phase -= error * 0.2f;
+    }
+    _phase -= floorf(_phase);
+    _isOnBeat = _phase < kOnBeatWidth;
+    _published.publish(state());
   }
 };
 
+#endif
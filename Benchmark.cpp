@@ -0,0 +1,182 @@
+#include "Benchmark.h"
+#include "Compositor.h"
+#include "Animations.h"
+#include "OutputStage.h"
+#include <memory>
+#include <vector>
+
+// Desktop machines need many more to get past the clock's resolution
+#ifndef SHINY_BENCHMARK_ITERATIONS
+#define SHINY_BENCHMARK_ITERATIONS 200
+#endif
+
+static const int kBenchmarkIterations = SHINY_BENCHMARK_ITERATIONS;
+static const int kBenchmarkLedCounts[] = { 50, 400, 800 };
+static const int kBenchmarkLayerCounts[] = { 1, 3, 5, LAYER_COUNT };
+
+// Seconds between benchmark frames, so animations move as they would at 60 fps
+static const TimeInterval kBenchmarkFrameTime = 1.0 / 60;
+
+static void printTiming(Print &out, const char *kind, const char *name, int pixels, int layers, unsigned long elapsed, int iterations)
+{
+    elapsed = max(1UL, elapsed);
+    float nsPerPixel = 1000.0f * elapsed / ((float)pixels * layers * iterations);
+    float mpixels = (float)pixels * layers * iterations / elapsed;
+    float fps = 1000000.0f * iterations / elapsed;
+    out.printf("%s,%s,%d,%d,%.2f,%.2f,%.1f\n", kind, name, pixels, layers, nsPerPixel, mpixels, fps);
+}
+
+void printBenchmarkHeader(Print &out)
+{
+    out.println("kind,name,pixels,layers,ns_per_pixel,mpixels_per_s,fps");
+}
+
+void benchmarkBlendModes(Print &out)
+{
+    // heap rather than static buffers, so builds without benchmarks don't pay for them
+    std::vector<CRGB> dst(MAX_LED_COUNT);
+    std::vector<CRGB> src(MAX_LED_COUNT);
+    for(int i = 0; i < MAX_LED_COUNT; i++)
+    {
+        dst[i] = CRGB(random8(), random8(), random8());
+        src[i] = CRGB(random8(), random8(), random8());
+    }
+
+    for(int pixels : kBenchmarkLedCounts)
+    {
+        for(int mode = 0; mode < BlendModeCount; mode++)
+        {
+            BlendSpanFunc blend = blendSpanFor((LayerBlendMode)mode);
+            unsigned long start = micros();
+            for(int i = 0; i < kBenchmarkIterations; i++)
+            {
+                blend(dst.data(), src.data(), pixels);
+            }
+            printTiming(out, "blend", blendModeNames[mode].c_str(), pixels, 1, micros() - start, kBenchmarkIterations);
+        }
+    }
+}
+
+void benchmarkAnimations(Print &out)
+{
+    std::vector<CRGB> front(MAX_LED_COUNT);
+    std::vector<CRGB> back(MAX_LED_COUNT);
+    SubStrip frontbuffer(front.data(), MAX_LED_COUNT);
+    SubStrip backbuffer(back.data(), MAX_LED_COUNT);
+    ShinyLayerSettings prefs;
+    NeighbourColors neighbours;
+    neighbours.count = 3;
+    neighbours.colors[0] = CRGB(255, 0, 0);
+    neighbours.colors[1] = CRGB(0, 255, 0);
+    neighbours.colors[2] = CRGB(0, 0, 255);
+
+    for(int fixedPoint = 0; fixedPoint < 2; fixedPoint++)
+    {
+        const char *kind = fixedPoint ? "animation_fixed" : "animation";
+        for(int pixels : kBenchmarkLedCounts)
+        {
+            frontbuffer.setNumPixels(pixels);
+            backbuffer.setNumPixels(pixels);
+            for(size_t animation = 1; animation < animationFuncs.size(); animation++)
+            {
+                prefs.animationIndex = animation;
+                prefs.fixedPoint = fixedPoint;
+                LayerAnimation layer(&backbuffer, &frontbuffer, &prefs);
+                layer.neighbours = &neighbours;
+
+                unsigned long start = micros();
+                for(int i = 0; i < kBenchmarkIterations; i++)
+                {
+                    layer.advance(i * kBenchmarkFrameTime, 1.0f / prefs.speed);
+                    layer.render();
+                }
+                printTiming(out, kind, animationNames[animation].c_str(), pixels, 1, micros() - start, kBenchmarkIterations);
+            }
+        }
+    }
+}
+
+// Whole frames with every layer moving, so nothing comes from the compositor's cache.
+// Layers cycle through the animations and blend modes.
+void benchmarkComposite(Print &out)
+{
+    std::vector<CRGB> front(MAX_LED_COUNT);
+    std::vector<CRGB> back(MAX_LED_COUNT);
+    std::vector<CRGB> cache(MAX_LED_COUNT);
+    SubStrip frontbuffer(front.data(), MAX_LED_COUNT);
+    SubStrip backbuffer(back.data(), MAX_LED_COUNT);
+    std::vector<ShinyLayerSettings> prefs(LAYER_COUNT);
+    for(int i = 0; i < LAYER_COUNT; i++)
+    {
+        prefs[i].animationIndex = 1 + i % (animationFuncs.size() - 1);
+        prefs[i].blendMode = (LayerBlendMode)(i % BlendModeCount);
+    }
+
+    for(int pixels : kBenchmarkLedCounts)
+    {
+        frontbuffer.setNumPixels(pixels);
+        backbuffer.setNumPixels(pixels);
+        for(int layerCount : kBenchmarkLayerCounts)
+        {
+            std::vector<LayerAnimation> layers;
+            for(int i = 0; i < layerCount; i++)
+            {
+                layers.emplace_back(&backbuffer, &frontbuffer, &prefs[i]);
+            }
+            Compositor compositor(layers.data(), layerCount, cache.data());
+
+            unsigned long start = micros();
+            for(int i = 0; i < kBenchmarkIterations; i++)
+            {
+                for(LayerAnimation &layer : layers)
+                {
+                    layer.advance(i * kBenchmarkFrameTime, 1.0f / layer.prefs->speed);
+                }
+                compositor.invalidate();
+                compositor.composite();
+            }
+            printTiming(out, "composite", "mixed", pixels, layerCount, micros() - start, kBenchmarkIterations);
+        }
+    }
+}
+
+void benchmarkOutput(Print &out)
+{
+    std::vector<CRGB> strip(MAX_LED_COUNT);
+    std::vector<CRGB> transmit(MAX_LED_COUNT);
+    for(int i = 0; i < MAX_LED_COUNT; i++)
+    {
+        strip[i] = CRGB(random8(), random8(), random8());
+    }
+    // too big for the stack, with its residuals
+    std::unique_ptr<OutputStage> stage(new OutputStage());
+    ShinySettings settings;
+    settings.mode = On;
+    settings.brightness = 77;
+
+    for(int dither = 0; dither < 2; dither++)
+    {
+        settings.dither = dither;
+        for(int pixels : kBenchmarkLedCounts)
+        {
+            settings.ledCount = pixels;
+            stage->configure(settings);
+            unsigned long start = micros();
+            for(int i = 0; i < kBenchmarkIterations; i++)
+            {
+                stage->write(transmit.data(), strip.data(), settings);
+            }
+            printTiming(out, "output", dither ? "dither" : "plain", pixels, 1, micros() - start, kBenchmarkIterations);
+        }
+    }
+}
+
+void runBenchmarks(Print &out)
+{
+    printBenchmarkHeader(out);
+    benchmarkBlendModes(out);
+    benchmarkAnimations(out);
+    benchmarkComposite(out);
+    benchmarkOutput(out);
+    out.println("benchmarks done");
+}
@@ -0,0 +1,31 @@
+#ifndef __BENCHMARK__H
+#define __BENCHMARK__H
+#include "Arduino.h"
+
+// Set to 1 to measure the render path on the device at boot and print the results over
+// serial as CSV, one "kind,name,pixels,layers,ns_per_pixel,mpixels_per_s,fps" line per
+// measurement, at each of 50, 400 and 800 pixels. ns_per_pixel and mpixels_per_s count
+// each pixel once per layer; fps is how many times a second the measured thing could run
+// on its own. make -C host bench runs the same suites on a desktop machine.
+#ifndef SHINY_RUN_BENCHMARKS
+#define SHINY_RUN_BENCHMARKS 0
+#endif
+
+// All of the below, after printBenchmarkHeader()
+void runBenchmarks(Print &out);
+
+// The CSV header line for what the benchmarks print
+void printBenchmarkHeader(Print &out);
+
+// Every blend mode's span kernel ("blend")
+void benchmarkBlendModes(Print &out);
+// Every animation, rendered and blended as one layer, with the float kernels
+// ("animation") and the fixed point ones ("animation_fixed")
+void benchmarkAnimations(Print &out);
+// Whole frames of 1, 3, 5 and LAYER_COUNT layers, all of them redrawn ("composite")
+void benchmarkComposite(Print &out);
+// OutputStage writing a transmit frame at 30% brightness, without dithering ("output",
+// "plain") and with it ("output", "dither")
+void benchmarkOutput(Print &out);
+
+#endif
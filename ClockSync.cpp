@@ -0,0 +1,230 @@
+#include "ClockSync.h"
+#include <math.h>
+#include <algorithm>
+#include <string.h>
+
+// Without a sample from upstream for this long, stop following and lead
+static const int64_t kLeaderTimeout = 10000000;
+// Errors larger than this are stepped away; smaller ones are slewed
+static const double kStepThreshold = 50000;
+// Slewing moves the clock at most this much faster or slower than real time
+static const double kMaxSlewRate = 0.05;
+// Crystals are good to a few tens of ppm; anything beyond this is a bad fit
+static const double kMaxSkew = 200e-6;
+// Drift is measured over at least this long
+static const int64_t kSkewBaseline = 30000000;
+// Leaders further away than this are taken to be gone. When a leader leaves, the cores
+// that followed it would otherwise keep it alive by following each other in a loop, one
+// more hop away each time round.
+static const int kMaxHops = 8;
+
+ClockSync::ClockSync()
+  : _priority(1), _leader(1), _hops(0), _upstream(0), _lastSample(0),
+    _nextPendingRequest(0), _nextSentResponse(0), _sampleCount(0), _nextSample(0), _fitLocal(0), _fitTarget(0), _anchorLocal(0), _anchorTarget(0), _skew(0), _offset(0), _lastUpdate(0)
+{
+    memset(_pendingRequests, 0, sizeof(_pendingRequests));
+    memset(_sentResponses, 0, sizeof(_sentResponses));
+}
+
+void ClockSync::begin(uint32_t priority)
+{
+    _priority = priority ? priority : 1;
+    lead();
+}
+
+void ClockSync::lead()
+{
+    // Keep the current offset, so the mesh clock just carries on from where it was
+    _leader = _priority;
+    _hops = 0;
+    _upstream = 0;
+    _sampleCount = 0;
+    _nextSample = 0;
+    _anchorLocal = 0;
+    _skew = 0;
+}
+
+ClockSyncPacket ClockSync::makeRequest(int64_t local)
+{
+    ClockSyncPacket packet = { ClockSyncRequest, _hops, _priority, _leader, meshTime(local), 0, 0 };
+    PendingRequest pending = { packet.t1, local };
+    _pendingRequests[_nextPendingRequest] = pending;
+    _nextPendingRequest = (_nextPendingRequest + 1) % kPendingRequests;
+    return packet;
+}
+
+ClockSyncPacket ClockSync::makeResponse(const ClockSyncPacket &request, int64_t received, int64_t local)
+{
+    ClockSyncPacket packet = { ClockSyncResponse, _hops, _priority, _leader, request.t1, meshTime(received), meshTime(local) };
+    SentResponse sent = { packet.t3, local };
+    _sentResponses[_nextSentResponse] = sent;
+    _nextSentResponse = (_nextSentResponse + 1) % kSentResponses;
+    return packet;
+}
+
+bool ClockSync::shouldFollow(uint32_t leader, uint8_t hops, uint32_t sender) const
+{
+    if(hops >= kMaxHops) return false;
+    if(leader != _leader) return leader > _leader;
+    if(isLeader()) return false;
+    if(sender == _upstream) return true;
+    return hops + 1 < _hops;
+}
+
+bool ClockSync::handleResponse(const ClockSyncPacket &response, int64_t received, ClockSyncPacket *adjust)
+{
+    PendingRequest *request = NULL;
+    for(PendingRequest &pending : _pendingRequests)
+    {
+        if(pending.t1 != 0 && pending.t1 == response.t1) request = &pending;
+    }
+    if(!request) return false;
+    request->t1 = 0;
+
+    // Both ends of the round trip at the current offset, in case it moved in between;
+    // otherwise a step while the request was out would show up as the delay, and a
+    // negative one would make this the sample all others are weighed against
+    int64_t t1 = meshTime(request->local);
+    int64_t t4 = meshTime(received);
+    int64_t correction = ((response.t2 - t1) + (response.t3 - t4)) / 2;
+    int64_t delay = (t4 - t1) - (response.t3 - response.t2);
+
+    if(shouldFollow(response.leader, response.hops, response.sender))
+    {
+        addSample(_offset + correction, delay, response.leader, response.hops, response.sender, received);
+        return false;
+    }
+
+    // A peer one hop further out may already be following us, and needs adjusting to
+    // keep doing so; if it follows someone else at our depth, it ignores the Adjust.
+    bool peerShouldFollow = _leader > response.leader
+        || (_leader == response.leader && _hops + 1 <= response.hops);
+    if(!peerShouldFollow) return false;
+
+    ClockSyncPacket packet = { ClockSyncAdjust, _hops, _priority, _leader, -correction, delay, response.t3 };
+    *adjust = packet;
+    return true;
+}
+
+void ClockSync::handleAdjust(const ClockSyncPacket &adjust, int64_t local)
+{
+    if(!shouldFollow(adjust.leader, adjust.hops, adjust.sender)) return;
+
+    // The correction is for when we responded, not now: our offset may have moved since
+    for(const SentResponse &sent : _sentResponses)
+    {
+        if(sent.t3 == 0 || sent.t3 != adjust.t3) continue;
+        addSample(adjust.t3 + adjust.t1 - sent.local, adjust.t2, adjust.leader, adjust.hops, adjust.sender, sent.local);
+        return;
+    }
+}
+
+void ClockSync::addSample(double target, int64_t delay, uint32_t leader, uint8_t hops, uint32_t sender, int64_t local)
+{
+    if(leader != _leader || sender != _upstream)
+    {
+        lead();
+        _leader = leader;
+        _upstream = sender;
+    }
+    _hops = hops + 1;
+    _lastSample = local;
+
+    Sample sample = { local, target, delay };
+    _samples[_nextSample] = sample;
+    _nextSample = (_nextSample + 1) % kSampleCount;
+    _sampleCount = std::min(_sampleCount + 1, (int)kSampleCount);
+
+    fit();
+}
+
+void ClockSync::fit()
+{
+    int64_t minDelay = _samples[0].delay;
+    int64_t first = _samples[0].local;
+    for(int i = 1; i < _sampleCount; i++)
+    {
+        minDelay = std::min(minDelay, _samples[i].delay);
+        first = std::min(first, _samples[i].local);
+    }
+
+    // Neither way of a round trip can take less than no time, so each sample is within
+    // half its delay of the true offset, however unevenly the delay was split. With the
+    // known drift taken out, the true offset lies where all those intervals overlap. Its
+    // middle is only off by half the difference between the quickest trip each way seen,
+    // rather than by each sample's own asymmetry, which doesn't average out over a hop
+    // or two.
+    double lowest = -INFINITY, highest = INFINITY;
+    for(int i = 0; i < _sampleCount; i++)
+    {
+        double y = _samples[i].target - _skew * (_samples[i].local - first);
+        double margin = std::max<int64_t>(_samples[i].delay, 0) / 2.0;
+        lowest = std::max(lowest, y - margin);
+        highest = std::min(highest, y + margin);
+    }
+    if(lowest <= highest)
+    {
+        _fitLocal = first;
+        _fitTarget = (lowest + highest) / 2;
+    }
+    else
+    {
+        // The intervals miss each other when upstream's clock moved under the samples,
+        // e.g. while it was still settling itself. Fall back to a weighted average, where
+        // samples that took much longer than the quickest one count for less.
+        double totalWeight = 0, meanX = 0, meanY = 0;
+        for(int i = 0; i < _sampleCount; i++)
+        {
+            double excess = (_samples[i].delay - minDelay) / 5000.0;
+            double weight = 1.0 / (1.0 + excess * excess);
+            double x = _samples[i].local - first;
+            totalWeight += weight;
+            meanX += weight * x;
+            meanY += weight * (_samples[i].target - _skew * x);
+        }
+        meanX /= totalWeight;
+        meanY /= totalWeight;
+        _fitLocal = first + (int64_t)meanX;
+        _fitTarget = meanY + _skew * meanX;
+    }
+
+    // Drift is far too small to see through the noise over a few samples, so measure it
+    // between fits a long way apart instead.
+    if(_anchorLocal == 0)
+    {
+        _anchorLocal = _fitLocal;
+        _anchorTarget = _fitTarget;
+    }
+    else if(_fitLocal - _anchorLocal >= kSkewBaseline)
+    {
+        double skew = (_fitTarget - _anchorTarget) / (_fitLocal - _anchorLocal);
+        _skew += (std::max(-kMaxSkew, std::min(kMaxSkew, skew)) - _skew) * 0.5;
+        _anchorLocal = _fitLocal;
+        _anchorTarget = _fitTarget;
+    }
+}
+
+void ClockSync::update(int64_t local)
+{
+    int64_t elapsed = _lastUpdate ? local - _lastUpdate : 0;
+    _lastUpdate = local;
+
+    if(!isLeader() && local - _lastSample > kLeaderTimeout)
+    {
+        lead();
+    }
+    if(isLeader() || _sampleCount == 0) return;
+
+    double target = _fitTarget + _skew * (local - _fitLocal);
+
+    double error = target - _offset;
+    if(fabs(error) > kStepThreshold)
+    {
+        _offset = target;
+    }
+    else
+    {
+        double maxSlew = kMaxSlewRate * elapsed;
+        _offset += std::max(-maxSlew, std::min(maxSlew, error));
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef __CLOCK_SYNC__H
+#define __CLOCK_SYNC__H
+#include <stdint.h>
+
+// Keeps a "mesh time" that all shinercores in range agree on, so their animations can
+// run in step (see MeshClockMaster).
+//
+// Every core picks a random priority at boot; the highest priority anyone has heard of is
+// the leader, and everyone else follows the neighbour closest to it. Following works like
+// NTP: a request/response round trip gives the offset between two clocks and the link
+// delay, which bounds how far off that offset can be; the recent samples' bounds are
+// overlapped to narrow it down, and fits a long way apart estimate how fast the two
+// crystals drift apart. The local mesh clock is then slewed
+// towards that estimate rather than stepped, so animations never visibly jump.
+//
+// Only centrals can start a round trip, so a central that finds its peer should follow
+// it instead sends the result back as an Adjust. All times are microseconds.
+
+enum ClockSyncPacketType : uint8_t
+{
+    ClockSyncRequest,  // central -> peripheral: t1 is when it was sent
+    ClockSyncResponse, // peripheral -> central: t1 echoed, t2 received, t3 sent
+    ClockSyncAdjust,   // central -> peripheral: t1 is how far off the peripheral's clock was at
+                       // the t3 of its response (echoed in t3), t2 the link delay
+};
+
+// What goes over the clock sync characteristic. Times are in the sender's mesh time.
+struct __attribute__((packed)) ClockSyncPacket
+{
+    uint8_t type;
+    uint8_t hops; // sender's distance from its leader
+    uint32_t sender; // sender's priority, which doubles as its id
+    uint32_t leader; // priority of the sender's leader
+    int64_t t1, t2, t3;
+};
+
+class ClockSync
+{
+public:
+    ClockSync();
+
+    void begin(uint32_t priority);
+
+    // Mesh time minus local time, at the given local time
+    int64_t offset() const { return (int64_t)_offset; }
+    int64_t meshTime(int64_t local) const { return local + offset(); }
+
+    bool isLeader() const { return _leader == _priority; }
+    uint32_t leader() const { return _leader; }
+    uint8_t hops() const { return _hops; }
+
+    // Remembers the request, so that only responses to it are taken (see handleResponse()).
+    ClockSyncPacket makeRequest(int64_t local);
+    // received and local are the local times the request arrived and the response is sent.
+    // Also remembers when it was sent, for an Adjust that may follow.
+    ClockSyncPacket makeResponse(const ClockSyncPacket &request, int64_t received, int64_t local);
+
+    // Central side. Returns true if the peer should follow us instead, with the Adjust to
+    // send it in adjust. Responses are notifications, so every central subscribed to the
+    // peer gets them; ones that don't answer one of our recent requests are ignored.
+    bool handleResponse(const ClockSyncPacket &response, int64_t received, ClockSyncPacket *adjust);
+    // Peripheral side
+    void handleAdjust(const ClockSyncPacket &adjust, int64_t local);
+
+    // Call often: slews the mesh clock, and falls back to leading if the leader is lost.
+    void update(int64_t local);
+private:
+    // A measurement of the offset we should have: upstream's mesh time minus local time
+    struct Sample
+    {
+        int64_t local;
+        double target;
+        int64_t delay;
+    };
+    static const int kSampleCount = 32;
+    // Requests we can still take a response to: one per peer, with room to spare
+    struct PendingRequest
+    {
+        int64_t t1; // as sent; 0 once answered
+        int64_t local;
+    };
+    static const int kPendingRequests = 8;
+    // Responses an Adjust can still refer to
+    struct SentResponse
+    {
+        int64_t t3;
+        int64_t local;
+    };
+    static const int kSentResponses = 8;
+
+    bool shouldFollow(uint32_t leader, uint8_t hops, uint32_t sender) const;
+    // target is the offset we should have had at local
+    void addSample(double target, int64_t delay, uint32_t leader, uint8_t hops, uint32_t sender, int64_t local);
+    void fit();
+    void lead();
+
+    uint32_t _priority;
+    uint32_t _leader;
+    uint8_t _hops;
+    uint32_t _upstream; // sender we follow, if not leading
+    int64_t _lastSample;
+
+    PendingRequest _pendingRequests[kPendingRequests];
+    int _nextPendingRequest;
+    SentResponse _sentResponses[kSentResponses];
+    int _nextSentResponse;
+
+    Sample _samples[kSampleCount];
+    int _sampleCount;
+    int _nextSample;
+    // Line fitted through the samples: the target offset is _fitTarget at _fitLocal,
+    // drifting by _skew per microsecond. _skew is measured against an older fit, the anchor.
+    int64_t _fitLocal;
+    double _fitTarget;
+    int64_t _anchorLocal;
+    double _anchorTarget;
+    double _skew;
+
+    double _offset;
+    int64_t _lastUpdate;
+};
+
+#endif
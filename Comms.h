@@ -4,24 +4,60 @@ BLEService shinerService("6c0de004-629d-4717-bed5-847fddfbdc2e");
 BLEStringCharacteristic documentationChara("76db9199-21af-4207-a23c-dc138a6cd42d", BLERead, 512);
 BLEDescriptor documentationNameDescriptor(kDescriptorUserDesc, "documentation");
 
-String buildDocumentationJSON() {
-    String json = "{\"blendModes\":[";
-    for(size_t i = 0; i < blendModeNames.size(); i++) {
-        if(i > 0) json += ",";
-        json += "\"" + blendModeNames[i] + "\"";
-    }
-    json += "],\"animations\":[";
-    for(size_t i = 0; i < animationNames.size(); i++) {
-        if(i > 0) json += ",";
-        json += "\"" + animationNames[i] + "\"";
-    }
-    json += "],\"ledColorOrders\":[";
-    for(size_t i = 0; i < ledColorOrderNames.size(); i++) {
-        if(i > 0) json += ",";
-        json += "\"" + ledColorOrderNames[i] + "\"";
+// Clock sync characteristic - binary ClockSyncPackets, see ClockSync.h. Not stored.
+BLECharacteristic clockSyncChara("09a11e6a-3ae0-4044-a7f7-b7a784524a1d", BLERead | BLEWrite | BLEWriteWithoutResponse | BLENotify, sizeof(ClockSyncPacket), true);
+BLEDescriptor clockSyncNameDescriptor(kDescriptorUserDesc, "clockSync");
+ClockSync clockSync;
+#define CLOCK_SYNC_INTERVAL 1.0
+
+// Scene characteristic - the whole scene as one binary blob, see SceneCodec.h. Reads and
+// notifications give the full scene; writes can be partial.
+BLECharacteristic sceneChara("c1711043-b082-4227-91eb-f99c654595da", BLERead | BLEWrite | BLENotify, SCENE_MAX_SIZE);
+BLEDescriptor sceneNameDescriptor(kDescriptorUserDesc, "scene");
+uint8_t publishedScene[SCENE_MAX_SIZE];
+int publishedSceneLength = 0;
+
+// Telemetry characteristic - per-stage timings, frame rates and free heap for the last
+// report window, see Telemetry.h. Not stored.
+BLECharacteristic telemetryChara("4e8f6a52-1c3d-4b7a-9e20-d5f1a7c8b396", BLERead | BLENotify, TELEMETRY_MAX_SIZE);
+BLEDescriptor telemetryNameDescriptor(kDescriptorUserDesc, "telemetry");
+
+// Preset characteristic - write "N" to crossfade to preset N, or "save N" to store the
+// current scene as preset N. Reads as the preset last recalled or saved, or -1.
+#define PRESET_COUNT 8
+BLEStringCharacteristic presetChara("2f1d5c3e-8a47-4b6e-9d0c-5e7a3b9f1c24", BLERead | BLEWrite | BLENotify, 16);
+BLEDescriptor presetNameDescriptor(kDescriptorUserDesc, "preset");
+int currentPreset = -1;
+
+// Lookups for the properties whose values are names
+NameIndex blendModeNameIndex(blendModeNames);
+NameIndex animationNameIndex(animationNames);
+NameIndex ledColorOrderNameIndex(ledColorOrderNames);
+NameIndex ledLayoutNameIndex(ledLayoutNames);
+NameIndex clockSourceNameIndex(clockSourceNames);
+
+// Builds into a fixed buffer the size of the characteristic; whatever doesn't fit is cut off.
+char documentationJSON[512];
+void appendDocumentationNames(int &length, const char *key, const std::vector<String> &names)
+{
+    int size = sizeof(documentationJSON);
+    length += snprintf(documentationJSON + std::min(length, size), std::max(size - length, 0), "%s\"%s\":[", length > 1 ? "]," : "", key);
+    for(size_t i = 0; i < names.size(); i++) {
+        length += snprintf(documentationJSON + std::min(length, size), std::max(size - length, 0), "%s\"%s\"", i > 0 ? "," : "", names[i].c_str());
     }
-    json += "]}";
-    return json;
+}
+
+const char *buildDocumentationJSON() {
+    int length = snprintf(documentationJSON, sizeof(documentationJSON), "{");
+    appendDocumentationNames(length, "blendModes", blendModeNames);
+    appendDocumentationNames(length, "animations", animationNames);
+    appendDocumentationNames(length, "ledColorOrders", ledColorOrderNames);
+    appendDocumentationNames(length, "ledLayouts", ledLayoutNames);
+    appendDocumentationNames(length, "clockSources", clockSourceNames);
+    int size = sizeof(documentationJSON);
+    length += snprintf(documentationJSON + std::min(length, size), std::max(size - length, 0), "]}");
+    if(length >= size) logger.println("documentation doesn't fit its characteristic!");
+    return documentationJSON;
 }
 
 // global settings
@@ -29,7 +65,8 @@ StoredProperty modeProp("70d4cabe-82cc-470a-a572-95c23f1316ff", "mode", "1", "0,
     setMode((RunMode)newValue.toInt());
 });
 StoredProperty brightnessProp("2B01", "brightness", "255", "0-255", [](const String &newValue) {
-    FastLED.setBrightness(newValue.toInt());
+    localPrefs.brightness = constrain(newValue.toInt(), 0, 255);
+    showButtonColor(localPrefs.layers[0].mainColor);
 });
 StoredProperty nameProp("7ad50f2a-01b5-4522-9792-d3fd4af5942f", "name", "unknown", "", [](const String &newValue) {
     ownerName = newValue;
@@ -39,31 +76,64 @@ StoredProperty layerProp("0a7eadd8-e4b8-4384-8308-e67a32262cc4", "layer", "1", "
 });
 StoredProperty ledCountProp("f5c67dcb-8798-4818-901f-cff9917d1a62", "ledCount", "400", "0-800", [](const String &newValue) {
     localPrefs.ledCount = constrain(newValue.toInt(), 0, MAX_LED_COUNT);
-    ledstrip.setNumPixels(localPrefs.ledCount);
-    backbuffer.setNumPixels(localPrefs.ledCount);
+    localPrefs.redraws++;
 });
 StoredProperty ledColorOrderProp("f3b7c8a1-5d2e-4f19-8c6a-9e1d0b2c3a4f", "ledColorOrder", "GRB", "", [](const String &newValue) {
-    std::vector<String>::iterator it = std::find(ledColorOrderNames.begin(), ledColorOrderNames.end(), newValue);
-    LedColorOrder order = (it != ledColorOrderNames.end())
-        ? (LedColorOrder)std::distance(ledColorOrderNames.begin(), it)
-        : LedOrderGRB;
+    int index = ledColorOrderNameIndex.find(newValue);
+    LedColorOrder order = (index >= 0) ? (LedColorOrder)index : LedOrderGRB;
 
     localPrefs.ledColorOrder = order;
+    localPrefs.redraws++;
+});
+StoredProperty ledLayoutProp("b5d75c8a-d9ba-4583-aaf3-4611ebd07e0a", "ledLayout", "Duplicate", "", [](const String &newValue) {
+    int index = ledLayoutNameIndex.find(newValue);
+    LedLayout layout = (index >= 0) ? (LedLayout)index : LedLayoutDuplicate;
+
+    localPrefs.ledLayout = layout;
+    localPrefs.redraws++;
+});
+StoredProperty ledOutputsProp("3d9a6e21-c5b8-4f07-8a3e-72d1f4b6c09e", "ledOutputs", "0 200 0 GRB;200 200 0 GRB", "", [](const String &newValue) {
+    ledOutputsFromString(newValue.c_str(), localPrefs.outputs);
+});
+StoredProperty ledSegmentsProp("a6e4b19d-2f73-4c58-9e0a-8b5d3c7f1e42", "ledSegments", "", "", [](const String &newValue) {
+    ledSegmentsFromString(newValue.c_str(), localPrefs.segments);
+});
+StoredProperty clockSourceProp("7b4ec190-0b0f-4993-907c-4d6f9bb4f8e8", "clockSource", "Wall", "", [](const String &newValue) {
+    int index = clockSourceNameIndex.find(newValue);
+    ClockSource source = (index >= 0) ? (ClockSource)index : ClockSourceWall;
+
+    localPrefs.clockSource = source;
+});
+StoredProperty whiteBalanceProp("9c2e7f14-3b6a-4d85-a1f0-6e4b8d2c7a93", "whiteBalance", "255 255 255", "0 0 0,255 255 255", [](const String &newValue) {
+    localPrefs.whiteBalance = rgbFromString(newValue);
+});
+StoredProperty outputGammaProp("51a8d3e6-7c2f-4b90-8e14-d5f6a0b3c729", "outputGamma", "1.0", "1.0,3.0", [](const String &newValue) {
+    localPrefs.outputGamma = constrain(newValue.toFloat(), 1.0f, 3.0f);
+});
+StoredProperty ditherProp("c4f07b2a-6e19-4d3c-95a8-1b7e0f5d8c62", "dither", "1", "0,1", [](const String &newValue) {
+    localPrefs.dither = newValue.toInt() != 0;
+});
+StoredProperty presetFadeProp("e63c0b8d-4f5a-4d21-b7e9-0a8c6f3d2b15", "presetFade", "1.0", "0.0,10.0", [](const String &newValue) {
+    localPrefs.presetFade = max(0.0f, newValue.toFloat());
 });
 
 // per-layer settings
 StoredMultiProperty speedProp("5341966c-da42-4b65-9c27-5de57b642e28", "speed", "1.0", "0.0,100.0", [](const String &newValue) {
     localPrefs.layers[StoredMultiProperty::getLayer()].speed = newValue.toFloat();
-    layerAnimations[StoredMultiProperty::getLayer()].duration = newValue.toFloat();
 });
 StoredMultiProperty colorProp("c116fce1-9a8a-4084-80a3-b83be2fbd108", "color1", "255 100 0", "0 0 0,255 255 255", [](const String &newValue) {
-    localPrefs.layers[StoredMultiProperty::getLayer()].mainColor = rgbFromString(newValue);
-    if (localPrefs.mode == 1) buttonled.fill(rgbFromString(newValue));
+    CRGB color = rgbFromString(newValue);
+    localPrefs.layers[StoredMultiProperty::getLayer()].mainColor = color;
+    showButtonColor(color);
+    localPrefs.redraws++;
 });
 StoredMultiProperty color2Prop("83595a76-1b17-4158-bcee-e702c3165caf", "color2", "240 255 0", "0 0 0,255 255 255", [](const String &newValue) {
     localPrefs.layers[StoredMultiProperty::getLayer()].secondaryColor = rgbFromString(newValue);
 });
 
+StoredMultiProperty segmentProp("e81f5c37-9a2d-4b64-b0c8-4d7e2a9f6b13", "segment", "0", "0-" STRINGIFY(SEGMENT_COUNT), [](const String &newValue) {
+    localPrefs.layers[StoredMultiProperty::getLayer()].segment = constrain(newValue.toInt(), 0, SEGMENT_COUNT);
+});
 StoredMultiProperty tauProp("d879c81a-09f0-4a24-a66c-cebf358bb97a", "tau", "10.0", "-100.0,100.0", [](const String &newValue) {
     localPrefs.layers[StoredMultiProperty::getLayer()].p_tau = newValue.toFloat();
 });
@@ -72,24 +142,20 @@ StoredMultiProperty phiProp("df6f0905-09bd-4bf6-b6f5-45b5a4d20d52", "phi", "4.0"
 });
 
 StoredMultiProperty blendModeProp("03686c5c-6e6f-44f0-943f-db6388d9fdd4", "blendMode", "Add", "", [](const String &newValue) {
-    std::vector<String>::iterator it = std::find(blendModeNames.begin(), blendModeNames.end(), newValue);
-    LayerBlendMode mode = (it != blendModeNames.end())
-        ? (LayerBlendMode)std::distance(blendModeNames.begin(), it)
-        : BlendModeAdd;
+    int index = blendModeNameIndex.find(newValue);
+    LayerBlendMode mode = (index >= 0) ? (LayerBlendMode)index : BlendModeAdd;
 
     localPrefs.layers[StoredMultiProperty::getLayer()].blendMode = mode;
 });
 
 StoredMultiProperty animationProp("bee29c30-aa11-45b2-b5a2-8ff8d0bab262", "animation", "Nothing", "", [](const String &newValue) {
-    std::vector<String>::iterator it = std::find(animationNames.begin(), animationNames.end(), newValue);
-    int animationIndex = (it != animationNames.end())
-        ? std::distance(animationNames.begin(), it)
+    int index = animationNameIndex.find(newValue);
+    localPrefs.layers[StoredMultiProperty::getLayer()].animationIndex = (index >= 0)
+        ? index
         : constrain(newValue.toInt(), 0, animationNames.size()-1);
-
-    localPrefs.layers[StoredMultiProperty::getLayer()].animationIndex = animationIndex;
 });
-std::vector<StoredProperty*> globalProps = {&modeProp, &brightnessProp, &nameProp, &layerProp, &ledColorOrderProp, &ledCountProp};
-std::vector<StoredProperty*> layerProps = {&speedProp, &colorProp, &color2Prop, &tauProp, &phiProp, &animationProp, &blendModeProp};
+std::vector<StoredProperty*> globalProps = {&modeProp, &brightnessProp, &nameProp, &layerProp, &ledColorOrderProp, &ledCountProp, &ledLayoutProp, &ledOutputsProp, &ledSegmentsProp, &clockSourceProp, &whiteBalanceProp, &outputGammaProp, &ditherProp, &presetFadeProp};
+std::vector<StoredProperty*> layerProps = {&speedProp, &colorProp, &color2Prop, &tauProp, &phiProp, &animationProp, &blendModeProp, &segmentProp};
 std::vector<StoredProperty*> props = [&] {
     std::vector<StoredProperty*> v;
     v.reserve(globalProps.size() + layerProps.size());
@@ -98,87 +164,309 @@ std::vector<StoredProperty*> props = [&] {
     return v;
 }();
 
+// Properties we follow on remote cores, and how to decode each into our mirror of that
+// core's settings. The per-layer ones are whatever layer the remote core has selected, so
+// layer comes first: selecting a layer re-sends that layer's values right after it.
+typedef void(*RemotePropertyDecoder)(ShinySettings &mirror, const char *value);
+struct MirroredProperty
+{
+    StoredProperty *prop;
+    RemotePropertyDecoder decode;
+};
+std::vector<MirroredProperty> mirroredProps = {
+    {&modeProp, [](ShinySettings &mirror, const char *value) {
+        mirror.mode = (RunMode)atoi(value);
+    }},
+    {&layerProp, [](ShinySettings &mirror, const char *value) {
+        mirror.currentLayerIndex = constrain(atoi(value), 0, LAYER_COUNT-1);
+    }},
+    {&colorProp, [](ShinySettings &mirror, const char *value) {
+        mirror.currentLayer()->mainColor = rgbFromString(value);
+    }},
+    {&color2Prop, [](ShinySettings &mirror, const char *value) {
+        mirror.currentLayer()->secondaryColor = rgbFromString(value);
+    }},
+    {&speedProp, [](ShinySettings &mirror, const char *value) {
+        mirror.currentLayer()->speed = atof(value);
+    }},
+    {&animationProp, [](ShinySettings &mirror, const char *value) {
+        int index = animationNameIndex.find(value);
+        if(index >= 0) mirror.currentLayer()->animationIndex = index;
+    }},
+};
+
+// Min/average/max of how long something took, in milliseconds
+struct LatencyStats
+{
+    uint32_t count = 0;
+    uint32_t minMs = 0;
+    uint32_t maxMs = 0;
+    uint64_t totalMs = 0;
+
+    void add(uint32_t ms)
+    {
+        minMs = count == 0 ? ms : std::min(minMs, ms);
+        maxMs = std::max(maxMs, ms);
+        totalMs += ms;
+        count++;
+    }
+    uint32_t averageMs() const { return count ? totalMs / count : 0; }
+};
+
+enum RemoteCoreState
+{
+    RemoteCoreConnecting,
+    RemoteCoreDiscovering,
+    RemoteCoreSubscribing,
+    RemoteCoreSubscribed,
+    RemoteCoreBackoff,
+    RemoteCoreGone, // failed again after the longest backoff; dropped on the next update
+};
+
+// Backoff between attempts doubles up to this, in seconds
+#define REMOTE_CORE_MAX_RETRY 60.0
+
+// Another shinercore we've found while scanning, and our connection to it.
+//
+// ArduinoBLE's connect, discover, read and subscribe calls all block, so they're split
+// into one step() each; commsUpdate() runs at most one step per tick across all remote
+// cores, so any number of them can be coming up at once without stalling the loop for
+// more than one call at a time. Everything else is in tick(), which never blocks.
+//
+// A core that's still failing after the longest backoff is most likely gone, so it's
+// dropped; if it comes back, scanning finds it again.
 class RemoteCore
 {
 public:
     RemoteCore(BLEDevice device) :
         device(device),
-        connected(false),
-        failed(false),
+        state(RemoteCoreConnecting),
+        untilNextRetry(0),
         retryDuration(1),
-        untilNextRetry(0)
+        lastRetryDuration(0),
+        untilNextSync(0),
+        subscribeStep(0),
+        attemptStarted(millis()),
+        failures(0)
     {}
 
     BLEDevice device;
     ShinySettings prefs;
-    bool connected;
-    bool failed;
+    RemoteCoreState state;
     TimeInterval untilNextRetry;
     TimeInterval retryDuration;
+    TimeInterval lastRetryDuration; // the backoff before the current attempt, or 0
+    BLECharacteristic clockSyncPeer;
+    TimeInterval untilNextSync;
+    // Same order as mirroredProps; empty where the remote core doesn't have it
+    std::vector<BLECharacteristic> mirroredCharas;
+    // While subscribing: a read and then a subscribe for each of mirroredProps, then
+    // subscribing to clock sync
+    size_t subscribeStep;
 
-    void fail()
+    // How long each part of bringing up the connection took
+    unsigned long attemptStarted;
+    LatencyStats connectLatency;
+    LatencyStats discoverLatency;
+    LatencyStats setupLatency; // from starting to connect until subscribed
+    uint32_t failures;
+
+    bool connected() const
     {
-        untilNextRetry = retryDuration;
-        retryDuration = std::min(retryDuration*2, 60.0);
-        logger.printf("Retrying in %.2f...\n", untilNextRetry);
-        failed = true;
-        connected = false;
+        return state == RemoteCoreDiscovering || state == RemoteCoreSubscribing || state == RemoteCoreSubscribed;
+    }
+
+    // True if step() has (blocking) work to do
+    bool wantsStep() const
+    {
+        return state == RemoteCoreConnecting || state == RemoteCoreDiscovering || state == RemoteCoreSubscribing;
+    }
+
+    void fail(const char *why)
+    {
+        logger.printf("%s: %s\n", device.address().c_str(), why);
+        failures++;
+        clockSyncPeer = BLECharacteristic();
+        mirroredCharas.clear();
         if(device && device.connected())
         {
             device.disconnect();
         }
+        if(lastRetryDuration >= REMOTE_CORE_MAX_RETRY)
+        {
+            logger.printf("Giving up on it\n");
+            state = RemoteCoreGone;
+            return;
+        }
+        untilNextRetry = retryDuration;
+        lastRetryDuration = retryDuration;
+        retryDuration = std::min(retryDuration*2, REMOTE_CORE_MAX_RETRY);
+        logger.printf("Retrying in %.2f...\n", untilNextRetry);
+        state = RemoteCoreBackoff;
     }
 
-    void elapseDelta(TimeInterval delta)
+    void step()
     {
-        untilNextRetry -= delta;
-        if(untilNextRetry <= 0)
+        unsigned long start = millis();
+        switch(state)
         {
-            logger.printf("Retrying!\n");
-            connect();
+            case RemoteCoreConnecting:
+                logger.printf("Connecting to %s...\n", device.localName().c_str());
+                if(!device.connect())
+                {
+                    fail("Failed to connect :'(");
+                    return;
+                }
+                connectLatency.add(millis() - start);
+                logger.printf("Connected!\n");
+                state = RemoteCoreDiscovering;
+                break;
+
+            case RemoteCoreDiscovering:
+                if(!device.discoverService(shinerService.uuid()))
+                {
+                    fail("Failed to discover shiner service");
+                    return;
+                }
+                discoverLatency.add(millis() - start);
+                mirroredCharas.clear();
+                subscribeStep = 0;
+                state = RemoteCoreSubscribing;
+                break;
+
+            case RemoteCoreSubscribing:
+            {
+                // Read everything once, then let notifications keep the mirror up to date
+                size_t index = subscribeStep / 2;
+                if(index < mirroredProps.size())
+                {
+                    const MirroredProperty &mirrored = mirroredProps[index];
+                    if(subscribeStep % 2 == 0)
+                    {
+                        BLECharacteristic chara = device.characteristic(mirrored.prop->uuid());
+                        if(chara && chara.read())
+                        {
+                            decode(mirrored, chara);
+                        }
+                        mirroredCharas.push_back(chara);
+                    }
+                    else if(mirroredCharas[index] && !mirroredCharas[index].subscribe())
+                    {
+                        mirroredCharas[index] = BLECharacteristic();
+                    }
+                    subscribeStep++;
+                    break;
+                }
+                logger.printf("That core has primary color %d %d %d\n", primaryColor().r, primaryColor().g, primaryColor().b);
+
+                clockSyncPeer = device.characteristic(clockSyncChara.uuid());
+                if(!clockSyncPeer || !clockSyncPeer.subscribe())
+                {
+                    logger.printf("That core doesn't do clock sync\n");
+                    clockSyncPeer = BLECharacteristic();
+                }
+
+                setupLatency.add(millis() - attemptStarted);
+                retryDuration = 1;
+                lastRetryDuration = 0;
+                state = RemoteCoreSubscribed;
+                break;
+            }
+
+            default:
+                break;
         }
     }
 
-    void connect()
+    // The main color of the layer the remote core has selected
+    CRGB primaryColor()
+    {
+        return prefs.currentLayer()->mainColor;
+    }
+
+    void decode(const MirroredProperty &mirrored, BLECharacteristic &chara)
     {
-        logger.printf("Connecting to %s...\n", this->device.localName().c_str());
-        if(!this->device.connect())
+        // Property values are at most 36 bytes, and not null terminated
+        char value[37];
+        int length = std::min(chara.valueLength(), 36);
+        memcpy(value, chara.value(), length);
+        value[length] = 0;
+        mirrored.decode(prefs, value);
+    }
+
+    void tick(TimeInterval delta)
+    {
+        if(connected() && !device.connected())
         {
-            this->fail();
-            logger.printf("Failed to connect :'(\n");
+            fail("Lost connection");
             return;
         }
-        this->connected = true;
-    
-        logger.printf("Connected!\n");
-    
-        if(!this->device.discoverService(shinerService.uuid()))
+
+        switch(state)
         {
-            logger.printf("Failed to discover shiner service\n");
-            this->fail();
-            return;
+            case RemoteCoreSubscribed:
+                for(size_t i = 0; i < mirroredCharas.size(); i++)
+                {
+                    if(mirroredCharas[i] && mirroredCharas[i].valueUpdated())
+                    {
+                        decode(mirroredProps[i], mirroredCharas[i]);
+                    }
+                }
+                syncClock(delta);
+                break;
+
+            case RemoteCoreBackoff:
+                untilNextRetry -= delta;
+                if(untilNextRetry <= 0)
+                {
+                    logger.printf("Retrying!\n");
+                    attemptStarted = millis();
+                    state = RemoteCoreConnecting;
+                }
+                break;
+
+            default:
+                break;
         }
-    
-        BLECharacteristic mainColor = this->device.characteristic(colorProp.uuid());
-        if(mainColor)
+    }
+
+    // Round trips with the remote core's clock once in a while, and handles its answers.
+    void syncClock(TimeInterval delta)
+    {
+        if(!clockSyncPeer) return;
+
+        if(clockSyncPeer.valueUpdated() && clockSyncPeer.valueLength() == sizeof(ClockSyncPacket))
         {
-            char colorStr[255];
-            // see also: characteristic.valueUpdated()
-            mainColor.readValue(colorStr, 255);
-            logger.printf("That core has primary color %s\n", colorStr);
-        } else {
-            logger.printf("Booo, can't read its color prop :(\n");
+            int64_t received = esp_timer_get_time();
+            ClockSyncPacket response;
+            memcpy(&response, clockSyncPeer.value(), sizeof(response));
+            ClockSyncPacket adjust;
+            if(response.type == ClockSyncResponse && clockSync.handleResponse(response, received, &adjust))
+            {
+                clockSyncPeer.writeValue((const uint8_t*)&adjust, sizeof(adjust), false);
+            }
+        }
+
+        untilNextSync -= delta;
+        if(untilNextSync <= 0)
+        {
+            untilNextSync = CLOCK_SYNC_INTERVAL;
+            ClockSyncPacket request = clockSync.makeRequest(esp_timer_get_time());
+            clockSyncPeer.writeValue((const uint8_t*)&request, sizeof(request), false);
         }
     }
 };
 std::vector<RemoteCore*> remoteCores;
 
+// How long reading and applying all settings took at boot
+uint32_t settingsLoadMicros;
+
 bool doAdvertise = true;
 bool doFindRemoteCores = false;
 
 void commsSetup(void)
 {
-    if (!prefs.begin("shinercore"))
+    if (!settingsStore.begin("shinercore"))
     {
         logger.println("failed to read preferences!");
         while (1);
@@ -189,17 +477,34 @@ void commsSetup(void)
         while (1);
     }
 
+    int64_t loadStarted = esp_timer_get_time();
     for(const auto& prop: props)
     {
         prop->load();
         prop->advertise(shinerService);
     }
+    settingsStore.finishLoad();
+    settingsLoadMicros = esp_timer_get_time() - loadStarted;
 
     // Add documentation characteristic (read-only, not stored)
     documentationChara.addDescriptor(documentationNameDescriptor);
     shinerService.addCharacteristic(documentationChara);
     documentationChara.writeValue(buildDocumentationJSON());
 
+    sceneChara.addDescriptor(sceneNameDescriptor);
+    shinerService.addCharacteristic(sceneChara);
+
+    telemetryChara.addDescriptor(telemetryNameDescriptor);
+    shinerService.addCharacteristic(telemetryChara);
+
+    presetChara.addDescriptor(presetNameDescriptor);
+    shinerService.addCharacteristic(presetChara);
+    presetChara.writeValue(String(currentPreset));
+
+    clockSync.begin(esp_random());
+    clockSyncChara.addDescriptor(clockSyncNameDescriptor);
+    shinerService.addCharacteristic(clockSyncChara);
+
     String name = ownerName + "'s shinercore";
     BLE.setDeviceName(name.c_str());
     BLE.setLocalName(name.c_str());
@@ -222,12 +527,211 @@ void commsSetup(void)
     }
 }
 
-void remoteCoreFound(BLEDevice foundDevice)
+std::vector<RemoteCore*>::size_type nextRemoteCoreStep = 0;
+
+void updateNeighbours(const NeighbourColors &neighbours)
+{
+    NeighbourColors &current = localPrefs.neighbours;
+    bool changed = neighbours.count != current.count;
+    for(int i = 0; !changed && i < neighbours.count; i++)
+    {
+        changed = neighbours.colors[i] != current.colors[i];
+    }
+    if(!changed) return;
+
+    current = neighbours;
+    localPrefs.redraws++;
+}
+
+static const char *remoteCoreStateNames[] = { "connecting", "discovering", "subscribing", "subscribed", "backoff", "gone" };
+
+void reportRemoteCores(Print &out)
+{
+    for(RemoteCore *remoteCore: remoteCores)
+    {
+        out.printf("Remote core %s: %s, %u failures; connect %u/%u/%u ms, discover %u/%u/%u ms, setup %u/%u/%u ms (min/avg/max)\n",
+            remoteCore->device.address().c_str(), remoteCoreStateNames[remoteCore->state], remoteCore->failures,
+            remoteCore->connectLatency.minMs, remoteCore->connectLatency.averageMs(), remoteCore->connectLatency.maxMs,
+            remoteCore->discoverLatency.minMs, remoteCore->discoverLatency.averageMs(), remoteCore->discoverLatency.maxMs,
+            remoteCore->setupLatency.minMs, remoteCore->setupLatency.averageMs(), remoteCore->setupLatency.maxMs);
+    }
+}
+
+// Applies a scene through the regular properties, so it's stored and shown exactly as if
+// each value had been written separately. All of it lands within one commsUpdate(), so
+// the render task sees it all at once.
+void applyScene(const SceneUpdate &scene)
+{
+    char value[kMaxValueLength + 1];
+    if(scene.globalMask & SceneGlobalMode)
+    {
+        snprintf(value, sizeof(value), "%d", (int)scene.mode);
+        modeProp.set(value);
+    }
+    if(scene.globalMask & SceneGlobalBrightness)
+    {
+        snprintf(value, sizeof(value), "%d", scene.brightness);
+        brightnessProp.set(value);
+    }
+
+    for(int i = 0; i < LAYER_COUNT; i++)
+    {
+        uint8_t fields = scene.fieldMasks[i];
+        const ShinyLayerSettings &layer = scene.layers[i];
+        if(!(scene.layerMask & (1 << i)))
+        {
+            if((scene.flags & SceneFlagFull) && localPrefs.layers[i].animationIndex != 0)
+            {
+                animationProp.setForLayer(i, animationNames[0].c_str());
+            }
+            continue;
+        }
+
+        auto setColor = [&](StoredMultiProperty &prop, const CRGB &c) {
+            snprintf(value, sizeof(value), "%d %d %d", c.r, c.g, c.b);
+            prop.setForLayer(i, value);
+        };
+        auto setFloat = [&](StoredMultiProperty &prop, float f) {
+            snprintf(value, sizeof(value), "%.4f", f);
+            prop.setForLayer(i, value);
+        };
+        if(fields & SceneFieldSpeed) setFloat(speedProp, layer.speed);
+        if(fields & SceneFieldMainColor) setColor(colorProp, layer.mainColor);
+        if(fields & SceneFieldSecondaryColor) setColor(color2Prop, layer.secondaryColor);
+        if(fields & SceneFieldTau) setFloat(tauProp, layer.p_tau);
+        if(fields & SceneFieldPhi) setFloat(phiProp, layer.p_phi);
+        if(fields & SceneFieldAnimation) animationProp.setForLayer(i, animationNames[layer.animationIndex].c_str());
+        if(fields & SceneFieldBlendMode) blendModeProp.setForLayer(i, blendModeNames[layer.blendMode].c_str());
+        if(fields & SceneFieldSegment)
+        {
+            snprintf(value, sizeof(value), "%d", layer.segment);
+            segmentProp.setForLayer(i, value);
+        }
+    }
+}
+
+// Takes scene writes, and notifies the full scene whenever anything in it changed, however
+// it was changed.
+void sceneUpdate()
 {
-    RemoteCore *remoteCore = new RemoteCore(foundDevice);
-    remoteCores.push_back(remoteCore);
+    if(sceneChara.written())
+    {
+        SceneUpdate scene;
+        if(decodeScene(sceneChara.value(), sceneChara.valueLength(), &scene))
+        {
+            applyScene(scene);
+        }
+        else
+        {
+            logger.println("Ignoring invalid scene");
+        }
+        // The characteristic now holds what was written; put the full scene back
+        publishedSceneLength = -1;
+    }
 
-    remoteCore->connect();
+    uint8_t encoded[SCENE_MAX_SIZE];
+    int length = encodeScene(localPrefs, brightnessProp.get().toInt(), encoded);
+    if(length != publishedSceneLength || memcmp(encoded, publishedScene, length) != 0)
+    {
+        memcpy(publishedScene, encoded, length);
+        publishedSceneLength = length;
+        sceneChara.writeValue(publishedScene, publishedSceneLength);
+    }
+}
+
+void publishTelemetry(const TelemetryReport &report)
+{
+    uint8_t encoded[TELEMETRY_MAX_SIZE];
+    int length = encodeTelemetry(report, encoded);
+    telemetryChara.writeValue(encoded, length);
+}
+
+// Presets are scenes (see SceneCodec.h), stored each under a key of their own. They're only
+// written when saved, so they go straight to flash rather than through settingsStore.
+String presetKey(int index)
+{
+    return "preset" + String(index);
+}
+
+bool savePreset(int index)
+{
+    uint8_t encoded[SCENE_MAX_SIZE];
+    int length = encodeScene(localPrefs, brightnessProp.get().toInt(), encoded);
+    if(prefs.putBytes(presetKey(index).c_str(), encoded, length) != length) return false;
+    currentPreset = index;
+    return true;
+}
+
+// Recalls only the layers: mode and brightness stay as they are, so a preset neither
+// turns the lights on nor makes them jump in brightness.
+bool recallPreset(int index)
+{
+    uint8_t encoded[SCENE_MAX_SIZE];
+    String key = presetKey(index);
+    size_t length = prefs.getBytesLength(key.c_str());
+    if(length == 0 || length > SCENE_MAX_SIZE || prefs.getBytes(key.c_str(), encoded, length) != length) return false;
+
+    SceneUpdate scene;
+    if(!decodeScene(encoded, length, &scene)) return false;
+    scene.globalMask = 0;
+    applyScene(scene);
+    localPrefs.presetRecalls++;
+    currentPreset = index;
+    return true;
+}
+
+// Recalls the next preset that has been saved, if any
+void nextPreset()
+{
+    for(int i = 1; i <= PRESET_COUNT; i++)
+    {
+        if(recallPreset((currentPreset + i + PRESET_COUNT) % PRESET_COUNT)) break;
+    }
+    presetChara.writeValue(String(currentPreset));
+}
+
+void presetUpdate()
+{
+    if(!presetChara.written()) return;
+
+    String command = presetChara.value();
+    bool save = command.startsWith("save ");
+    int index = (save ? command.substring(5) : command).toInt();
+    if(index < 0 || index >= PRESET_COUNT)
+    {
+        logger.println("Ignoring invalid preset");
+    }
+    else if(save ? !savePreset(index) : !recallPreset(index))
+    {
+        logger.print(save ? "Couldn't save preset " : "No preset "); logger.println(index);
+    }
+    presetChara.writeValue(String(currentPreset));
+}
+
+// Peripheral side of clock sync: answers requests and takes adjustments from centrals,
+// and keeps the mesh clock slewing.
+void clockSyncUpdate()
+{
+    if(clockSyncChara.written() && clockSyncChara.valueLength() == sizeof(ClockSyncPacket))
+    {
+        // The write came in during BLE.poll(), just before this; close enough, and the
+        // central's delay estimate absorbs it
+        int64_t received = esp_timer_get_time();
+        ClockSyncPacket packet;
+        memcpy(&packet, clockSyncChara.value(), sizeof(packet));
+        if(packet.type == ClockSyncRequest)
+        {
+            ClockSyncPacket response = clockSync.makeResponse(packet, received, esp_timer_get_time());
+            clockSyncChara.writeValue((const uint8_t*)&response, sizeof(response));
+        }
+        else if(packet.type == ClockSyncAdjust)
+        {
+            clockSync.handleAdjust(packet, received);
+        }
+    }
+
+    clockSync.update(esp_timer_get_time());
+    meshClock.setOffset(clockSync.offset());
 }
 
 void commsUpdate(TimeInterval delta)
@@ -238,6 +742,9 @@ void commsUpdate(TimeInterval delta)
     {
         prop->poll();
     }
+    clockSyncUpdate();
+    sceneUpdate();
+    presetUpdate();
 
     if (doFindRemoteCores)
     {
@@ -247,32 +754,40 @@ void commsUpdate(TimeInterval delta)
         };
         if(foundDevice && std::find_if(remoteCores.begin(), remoteCores.end(), containsFoundDevice) == remoteCores.end())
         {
-            // can't connect while scanning
-            BLE.stopScan();
-    
-            // Query and insert into local state
-            remoteCoreFound(foundDevice);
-    
-            // all done connecting, keep scanning
-            BLE.scanForUuid(shinerService.uuid());
+            // Just remember it; it connects when its turn to step comes
+            remoteCores.push_back(new RemoteCore(foundDevice));
         }
     }
 
-    for(auto it = remoteCores.begin(); it != remoteCores.end(); ++it)
+    NeighbourColors neighbours;
+    for(RemoteCore *remoteCore: remoteCores)
     {
-        RemoteCore *remoteCore = *it;
-        if(remoteCore->connected)
+        remoteCore->tick(delta);
+        if(remoteCore->state == RemoteCoreSubscribed && remoteCore->prefs.mode != Off && neighbours.count < MAX_NEIGHBOURS)
         {
-            remoteCore->device.poll();
-            if(!remoteCore->device.connected())
-            {
-                logger.printf("Lost connection to %s.\n", remoteCore->device.localName().c_str());
-                it = remoteCores.erase(it);
-            }
-        }
-        else
-        {
-            remoteCore->elapseDelta(delta);
+            neighbours.colors[neighbours.count++] = remoteCore->primaryColor();
         }
     }
+    updateNeighbours(neighbours);
+
+    remoteCores.erase(std::remove_if(remoteCores.begin(), remoteCores.end(), [](RemoteCore *remoteCore) {
+        if(remoteCore->state != RemoteCoreGone) return false;
+        delete remoteCore;
+        return true;
+    }), remoteCores.end());
+
+    // At most one blocking step per tick, taking turns between the remote cores
+    for(std::vector<RemoteCore*>::size_type i = 0; i < remoteCores.size(); i++)
+    {
+        RemoteCore *remoteCore = remoteCores[(nextRemoteCoreStep + i) % remoteCores.size()];
+        if(!remoteCore->wantsStep()) continue;
+
+        nextRemoteCoreStep = (nextRemoteCoreStep + i + 1) % remoteCores.size();
+        // can't connect while scanning
+        bool pauseScan = doFindRemoteCores && remoteCore->state == RemoteCoreConnecting;
+        if(pauseScan) BLE.stopScan();
+        remoteCore->step();
+        if(pauseScan) BLE.scanForUuid(shinerService.uuid());
+        break;
+    }
 }
@@ -0,0 +1,252 @@
+#include "Compositor.h"
+#include "Telemetry.h"
+#include <esp_timer.h>
+#include <type_traits>
+
+// Every blend mode works on each channel independently (except Dissolve, which picks
+// whole pixels), so a span of pixels is blended as a flat run of bytes. Modes that can
+// be written with plain integer ops also get a SWAR version that blends four bytes per
+// 32-bit word; the rest run byte by byte, but still without a per-pixel switch.
+//
+// The ESP32-S3's PIE vector unit could blend 16 bytes per instruction, but only from
+// 16-byte aligned buffers and through inline assembly the host build can't run, so the
+// kernels stick to plain C that both builds check against the same goldens.
+
+typedef uint32_t __attribute__((__may_alias__)) PackedBytes;
+static const uint32_t kHighBits = 0x80808080;
+static const uint32_t kLowBits = 0x7F7F7F7F;
+
+// 0xFF in every byte whose high bit is set in highBits
+static inline uint32_t byteMask(uint32_t highBits) { return (highBits >> 7) * 0xFF; }
+
+static inline uint32_t addWrap4(uint32_t a, uint32_t b)
+{
+    return ((a & kLowBits) + (b & kLowBits)) ^ ((a ^ b) & kHighBits);
+}
+
+static inline uint32_t subtractWrap4(uint32_t a, uint32_t b)
+{
+    return ((a | kHighBits) - (b & kLowBits)) ^ ((a ^ ~b) & kHighBits);
+}
+
+static inline uint32_t add4(uint32_t a, uint32_t b)
+{
+    uint32_t sum = addWrap4(a, b);
+    uint32_t carries = ((a & b) | ((a | b) & ~sum)) & kHighBits;
+    return sum | byteMask(carries);
+}
+
+static inline uint32_t subtract4(uint32_t a, uint32_t b)
+{
+    uint32_t diff = subtractWrap4(a, b);
+    uint32_t borrows = ((~a & b) | (~(a ^ b) & diff)) & kHighBits;
+    return diff & ~byteMask(borrows);
+}
+
+// (a * b) >> 8 per byte. The core has no packed multiply, so the even and odd bytes are
+// spread into 16-bit lanes, which a byte's product fits in, and multiplied a lane at a
+// time; the loads, masks and stores around them are shared by all four bytes.
+static inline uint32_t multiply4(uint32_t a, uint32_t b)
+{
+    uint32_t aEven = a & 0x00FF00FF, bEven = b & 0x00FF00FF;
+    uint32_t aOdd = (a >> 8) & 0x00FF00FF, bOdd = (b >> 8) & 0x00FF00FF;
+    uint32_t even = (aEven & 0xFFFF) * (bEven & 0xFFFF) | ((aEven >> 16) * (bEven >> 16)) << 16;
+    uint32_t odd = (aOdd & 0xFFFF) * (bOdd & 0xFFFF) | ((aOdd >> 16) * (bOdd >> 16)) << 16;
+    // each lane's high byte is its result
+    return ((even >> 8) & 0x00FF00FF) | (odd & 0xFF00FF00);
+}
+
+template<LayerBlendMode Mode> struct BlendOp;
+
+template<> struct BlendOp<BlendModeAdd> {
+    static const bool packed = true;
+    static inline uint8_t channel(uint8_t a, uint8_t b) { return qadd8(a, b); }
+    static inline uint32_t word(uint32_t a, uint32_t b) { return add4(a, b); }
+};
+template<> struct BlendOp<BlendModeSubtract> {
+    static const bool packed = true;
+    static inline uint8_t channel(uint8_t a, uint8_t b) { return qsub8(a, b); }
+    static inline uint32_t word(uint32_t a, uint32_t b) { return subtract4(a, b); }
+};
+template<> struct BlendOp<BlendModeAddWrap> {
+    static const bool packed = true;
+    static inline uint8_t channel(uint8_t a, uint8_t b) { return a + b; }
+    static inline uint32_t word(uint32_t a, uint32_t b) { return addWrap4(a, b); }
+};
+template<> struct BlendOp<BlendModeSubtractWrap> {
+    static const bool packed = true;
+    static inline uint8_t channel(uint8_t a, uint8_t b) { return a - b; }
+    static inline uint32_t word(uint32_t a, uint32_t b) { return subtractWrap4(a, b); }
+};
+template<> struct BlendOp<BlendModeMultiply> {
+    static const bool packed = true;
+    static inline uint8_t channel(uint8_t a, uint8_t b) { return (a * b) >> 8; }
+    static inline uint32_t word(uint32_t a, uint32_t b) { return multiply4(a, b); }
+};
+template<> struct BlendOp<BlendModeAverage> {
+    static const bool packed = true;
+    static inline uint8_t channel(uint8_t a, uint8_t b) { return (a + b) >> 1; }
+    static inline uint32_t word(uint32_t a, uint32_t b) { return (a & b) + (((a ^ b) >> 1) & kLowBits); }
+};
+template<> struct BlendOp<BlendModeScreen> {
+    static const bool packed = true;
+    static inline uint8_t channel(uint8_t a, uint8_t b) { return 255 - (((255-a) * (255-b)) >> 8); }
+    static inline uint32_t word(uint32_t a, uint32_t b) { return ~multiply4(~a, ~b); }
+};
+template<> struct BlendOp<BlendModeLighten> {
+    static const bool packed = true;
+    static inline uint8_t channel(uint8_t a, uint8_t b) { return max(a, b); }
+    static inline uint32_t word(uint32_t a, uint32_t b) { return b + subtract4(a, b); }
+};
+template<> struct BlendOp<BlendModeDarken> {
+    static const bool packed = true;
+    static inline uint8_t channel(uint8_t a, uint8_t b) { return min(a, b); }
+    static inline uint32_t word(uint32_t a, uint32_t b) { return a - subtract4(a, b); }
+};
+template<> struct BlendOp<BlendModeDifference> {
+    static const bool packed = true;
+    static inline uint8_t channel(uint8_t a, uint8_t b) { return abs(a - b); }
+    static inline uint32_t word(uint32_t a, uint32_t b) { return subtract4(a, b) | subtract4(b, a); }
+};
+template<> struct BlendOp<BlendModeOverlay> {
+    static const bool packed = false;
+    static inline uint8_t channel(uint8_t a, uint8_t b) { return a < 128 ? (2 * a * b) >> 8 : 255 - ((2 * (255-a) * (255-b)) >> 8); }
+};
+template<> struct BlendOp<BlendModeColorDodge> {
+    static const bool packed = false;
+    static inline uint8_t channel(uint8_t a, uint8_t b) { return b == 255 ? 255 : min(255, (a << 8) / (255 - b)); }
+};
+
+template<class Op>
+static inline void blendBytes(uint8_t *dst, const uint8_t *src, int count, std::false_type packed)
+{
+    for(int i = 0; i < count; i++)
+    {
+        dst[i] = Op::channel(dst[i], src[i]);
+    }
+}
+
+template<class Op>
+static inline void blendBytes(uint8_t *dst, const uint8_t *src, int count, std::true_type packed)
+{
+    // Word accesses need both buffers to line up; the strips are allocated aligned, so
+    // that's the normal case, and anything else just takes the byte loop.
+    if(((uintptr_t)dst & 3) != ((uintptr_t)src & 3))
+    {
+        blendBytes<Op>(dst, src, count, std::false_type());
+        return;
+    }
+
+    int head = min(count, (int)((4 - ((uintptr_t)dst & 3)) & 3));
+    blendBytes<Op>(dst, src, head, std::false_type());
+
+    PackedBytes *dstWords = (PackedBytes*)(dst + head);
+    const PackedBytes *srcWords = (const PackedBytes*)(src + head);
+    int words = (count - head) / 4;
+    for(int i = 0; i < words; i++)
+    {
+        dstWords[i] = Op::word(dstWords[i], srcWords[i]);
+    }
+
+    int done = head + words * 4;
+    blendBytes<Op>(dst + done, src + done, count - done, std::false_type());
+}
+
+template<LayerBlendMode Mode>
+void blendSpan(CRGB *dst, const CRGB *src, int count)
+{
+    typedef BlendOp<Mode> Op;
+    blendBytes<Op>((uint8_t*)dst, (const uint8_t*)src, count * 3, std::integral_constant<bool, Op::packed>());
+}
+
+template<>
+void blendSpan<BlendModeSet>(CRGB *dst, const CRGB *src, int count)
+{
+    memcpy(dst, src, count * sizeof(CRGB));
+}
+
+// Picks whole pixels rather than channels, so it can't run on bytes.
+template<>
+void blendSpan<BlendModeDissolve>(CRGB *dst, const CRGB *src, int count)
+{
+    for(int i = 0; i < count; i++)
+    {
+        if(random8() >= 128) dst[i] = src[i];
+    }
+}
+
+static const BlendSpanFunc blendSpans[BlendModeCount] = {
+    blendSpan<BlendModeAdd>,
+    blendSpan<BlendModeSubtract>,
+    blendSpan<BlendModeAddWrap>,
+    blendSpan<BlendModeSubtractWrap>,
+    blendSpan<BlendModeMultiply>,
+    blendSpan<BlendModeDissolve>,
+    blendSpan<BlendModeAverage>,
+    blendSpan<BlendModeSet>,
+    blendSpan<BlendModeScreen>,
+    blendSpan<BlendModeLighten>,
+    blendSpan<BlendModeDarken>,
+    blendSpan<BlendModeDifference>,
+    blendSpan<BlendModeOverlay>,
+    blendSpan<BlendModeColorDodge>,
+};
+
+BlendSpanFunc blendSpanFor(LayerBlendMode mode)
+{
+    if(mode < 0 || mode >= BlendModeCount) return blendSpans[BlendModeAdd];
+    return blendSpans[mode];
+}
+
+bool Compositor::composite()
+{
+    int firstDirty = _layerCount;
+    for(int i = 0; i < _layerCount; i++)
+    {
+        if(_layers[i].needsRender())
+        {
+            firstDirty = i;
+            break;
+        }
+    }
+
+    if(_invalidated)
+    {
+        _invalidated = false;
+        _cachedLayers = 0;
+        firstDirty = 0;
+    }
+    else if(firstDirty == _layerCount)
+    {
+        return false;
+    }
+
+    SubStrip *frontbuffer = _layers[0].frontbuffer;
+    CRGB *front = &(*frontbuffer)[0];
+    int numPixels = frontbuffer->numPixels();
+
+    int start = 0;
+    if(_cachedLayers > 0 && _cachedLayers <= firstDirty)
+    {
+        memcpy(front, _cache, numPixels * sizeof(CRGB));
+        start = _cachedLayers;
+    }
+    else
+    {
+        frontbuffer->fill(CRGB::Black); // TODO: clear with layer 0 instead, to allow feedback patterns
+        _cachedLayers = 0;
+    }
+
+    for(int i = start; i < _layerCount; i++)
+    {
+        if(i == firstDirty && i > _cachedLayers)
+        {
+            memcpy(_cache, front, numPixels * sizeof(CRGB));
+            _cachedLayers = i;
+        }
+        int64_t started = esp_timer_get_time();
+        _layers[i].render();
+        if(i < LAYER_COUNT) telemetry.recordSince((TelemetryStage)(StageLayer0 + i), started);
+    }
+    return true;
+}
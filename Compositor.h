@@ -0,0 +1,46 @@
+#ifndef __COMPOSITOR__H
+#define __COMPOSITOR__H
+#include "FastLED.h"
+#include "ShinyTypes.h"
+#include "LayerAnimation.h"
+
+// Blends count pixels of src (a layer's freshly rendered content) onto dst (what's on
+// the strip so far), in place.
+typedef void(*BlendSpanFunc)(CRGB *dst, const CRGB *src, int count);
+
+// One kernel per LayerBlendMode, so the mode is resolved once per layer instead of once
+// per pixel. Unknown modes get the Add kernel, like the old per-pixel switch did.
+BlendSpanFunc blendSpanFor(LayerBlendMode mode);
+
+// Stacks the layers onto their shared frontbuffer, redrawing only what changed.
+//
+// Layers are asked whether they'd draw anything different since the last frame. If none
+// would, the frame is left alone entirely. Otherwise, everything below the lowest changed
+// layer is restored from a cached composite, so a static background under a moving top
+// layer is drawn once rather than every frame.
+class Compositor
+{
+public:
+    // cache must hold as many pixels as the frontbuffer can
+    Compositor(LayerAnimation *layers, int layerCount, CRGB *cache)
+      : _layers(layers), _layerCount(layerCount), _cache(cache), _cachedLayers(0), _invalidated(true)
+    {}
+
+    // Returns true if the frontbuffer was redrawn and needs to be shown.
+    bool composite();
+
+    // Forces the next composite() to redraw everything, e.g. when something outside the
+    // layers (strip length, color order, neighbours) changed what has to be shown. Only
+    // from the task that calls composite(); other tasks bump ShinySettings::redraws,
+    // which reaches it together with the settings that changed.
+    void invalidate() { _invalidated = true; }
+private:
+    LayerAnimation *_layers;
+    int _layerCount;
+    CRGB *_cache;
+    // _cache holds the composite of layers [0, _cachedLayers)
+    int _cachedLayers;
+    bool _invalidated;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include "Fft.h"
+#include <math.h>
+#include <algorithm>
+
+#if __has_include(<esp_dsp.h>)
+#include <esp_dsp.h>
+
+bool fftSetup()
+{
+    return dsps_fft2r_init_fc32(NULL, FFT_MAX_SIZE) == ESP_OK;
+}
+
+void fft(float *data, int n)
+{
+    dsps_fft2r_fc32(data, n);
+    dsps_bit_rev_fc32(data, n);
+}
+
+#else
+
+// cos and -sin of 2*pi*k/FFT_MAX_SIZE; a smaller transform uses every (FFT_MAX_SIZE/n)th
+static float twiddles[FFT_MAX_SIZE];
+
+bool fftSetup()
+{
+    for(int k = 0; k < FFT_MAX_SIZE/2; k++)
+    {
+        twiddles[2*k] = cosf(2 * M_PI * k / FFT_MAX_SIZE);
+        twiddles[2*k+1] = -sinf(2 * M_PI * k / FFT_MAX_SIZE);
+    }
+    return true;
+}
+
+void fft(float *data, int n)
+{
+    for(int i = 1, j = 0; i < n; i++)
+    {
+        int bit = n >> 1;
+        for(; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if(i < j)
+        {
+            std::swap(data[2*i], data[2*j]);
+            std::swap(data[2*i+1], data[2*j+1]);
+        }
+    }
+
+    for(int len = 2; len <= n; len <<= 1)
+    {
+        int half = len / 2;
+        int stride = FFT_MAX_SIZE / len;
+        for(int start = 0; start < n; start += len)
+        {
+            for(int k = 0; k < half; k++)
+            {
+                float wr = twiddles[2*k*stride];
+                float wi = twiddles[2*k*stride+1];
+                float *a = &data[2*(start+k)];
+                float *b = &data[2*(start+k+half)];
+                float tr = b[0]*wr - b[1]*wi;
+                float ti = b[0]*wi + b[1]*wr;
+                b[0] = a[0] - tr;
+                b[1] = a[1] - ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
+        }
+    }
+}
+
+#endif
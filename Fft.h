@@ -0,0 +1,16 @@
+#ifndef __FFT__H
+#define __FFT__H
+
+// Radix-2 complex FFT for the beat detector. Uses esp-dsp's optimized kernels when that
+// library is installed, and a portable implementation otherwise.
+
+#define FFT_MAX_SIZE 1024
+
+// Builds the twiddle tables. Call once before fft().
+bool fftSetup();
+
+// In-place forward FFT of n complex values stored as interleaved (re, im) floats.
+// n must be a power of two, at most FFT_MAX_SIZE. The result is in natural order.
+void fft(float *data, int n);
+
+#endif
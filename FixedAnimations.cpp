@@ -0,0 +1,290 @@
+#include "Animations.h"
+#include "FixedMath.h"
+#include "Util.h"
+
+// Integer versions of the kernels in Animations.cpp. Each one produces the same frame as
+// its float twin to within one LSB per channel, but the per-pixel loops only use table
+// lookups, adds and multiplies; anything that needs float is done once per frame.
+
+void NothingAnim(LayerAnimation *self, TimeInterval t);
+void TheaterChaseAnim(LayerAnimation *self, TimeInterval t);
+void NeighboursAnim(LayerAnimation *self, TimeInterval t);
+
+// Step per pixel for an input that advances by 1/divisor; zero divisors just stand still.
+static inline uint32_t curveStepPer(float divisor)
+{
+    return divisor == 0 ? 0 : curveStep(1.0 / divisor);
+}
+
+void OpposingWavesAnimQ16(LayerAnimation *self, TimeInterval t)
+{
+    SubStrip *strip = &self->canvas;
+    ShinyLayerSettings *prefs = self->prefs;
+    uint32_t phaseA = curvePhase(t);
+    uint32_t phaseB = phaseA;
+    uint32_t stepA = curveStepPer(prefs->p_tau);
+    uint32_t stepB = curveStepPer(prefs->p_phi);
+    for(int i = 0; i < strip->numPixels(); i++)
+    {
+        uint16_t a = gamma16(curve16(phaseA)) >> 1;
+        uint16_t b = gamma16(curve16(phaseB)) >> 1;
+        strip->set(i, scale16(prefs->mainColor, a) + scale16(prefs->secondaryColor, b));
+        phaseA -= stepA;
+        phaseB += stepB;
+    }
+}
+
+void SingleWaveAnimQ16(LayerAnimation *self, TimeInterval t)
+{
+    SubStrip *strip = &self->canvas;
+    ShinyLayerSettings *prefs = self->prefs;
+    uint32_t phase = curvePhase(t + prefs->p_phi);
+    uint32_t step = curveStepPer(prefs->p_tau);
+    for(int i = 0; i < strip->numPixels(); i++)
+    {
+        strip->set(i, scale16(prefs->mainColor, gamma16(curve16(phase))));
+        phase -= step;
+    }
+}
+
+// Every pixel is the same color, so work it out once and fill.
+void BreatheAnimQ16(LayerAnimation *self, TimeInterval t)
+{
+    SubStrip *strip = &self->canvas;
+    ShinyLayerSettings *prefs = self->prefs;
+    CRGB color = scale16(prefs->mainColor, gamma16(curve16(curvePhase(t))))
+               + scale16(prefs->secondaryColor, gamma16(curve16(curvePhase(t+0.5))));
+    strip->fill(color);
+}
+
+void RainbowAnimQ16(LayerAnimation *self, TimeInterval t)
+{
+    SubStrip *strip = &self->canvas;
+    ShinyLayerSettings *prefs = self->prefs;
+    int numPixels = strip->numPixels();
+    if(numPixels == 0) return;
+
+    float rainbowCycles = prefs->p_tau / 10.0f;
+    float speedMult = prefs->p_phi / 4.0f;
+
+    // Hue position as Q32 cycles. Not wrapped, since the float version truncates toward
+    // zero when it converts to uint8_t, so negative positions round the other way.
+    int64_t hue = llround((double)t * speedMult * 4294967296.0);
+    int64_t step = llround((double)rainbowCycles / numPixels * 4294967296.0);
+    for(int i = 0; i < numPixels; i++)
+    {
+        int64_t hue8 = hue >> 24;
+        if(hue < 0 && (hue & 0xFFFFFF)) hue8++;
+        strip->set(i, CHSV((uint8_t)hue8, 240, 255));
+        hue += step;
+    }
+}
+
+void CometAnimQ16(LayerAnimation *self, TimeInterval t)
+{
+    SubStrip *strip = &self->canvas;
+    ShinyLayerSettings *prefs = self->prefs;
+    int numPixels = strip->numPixels();
+
+    float tailLength = prefs->p_tau * 5.0f;
+    float cometWidth = std::max(1.0f, prefs->p_phi);
+    double cometPos = fmod(t * numPixels, numPixels + tailLength);
+
+    // Pixel ranges covered by the head and the tail. Head: 0 <= cometPos-i < cometWidth,
+    // tail: cometWidth <= cometPos-i < cometWidth+tailLength.
+    int headLast = (int)floor(cometPos);
+    int headFirst = (int)floor(cometPos - cometWidth) + 1;
+    int tailLast = headFirst - 1;
+    int tailFirst = (int)floor(cometPos - cometWidth - tailLength) + 1;
+    if(tailLength <= 0) tailFirst = tailLast + 1;
+
+    // The tail's linear fade rises by 1/tailLength per pixel from tailFirst on. Q32, so
+    // the rounding of the step doesn't add up over long tails.
+    double tailStart = cometPos - cometWidth - tailLength;
+    int64_t fadeStep = tailLength > 0 ? llround(4294967296.0 / tailLength) : 0;
+    int64_t fade = tailLength > 0 ? llround((tailFirst - tailStart) / tailLength * 4294967296.0) : 0;
+
+    for(int i = 0; i < numPixels; i++)
+    {
+        if(i >= headFirst && i <= headLast) {
+            strip->set(i, prefs->mainColor);
+        } else if(i >= tailFirst && i <= tailLast) {
+            int32_t f = constrain((fade + (i - tailFirst) * fadeStep) >> 16, (int64_t)0, (int64_t)65535);
+            strip->set(i, scale16(prefs->secondaryColor, mul16(f, f)));
+        } else {
+            strip->set(i, CRGB::Black);
+        }
+    }
+}
+
+void ScannerAnimQ16(LayerAnimation *self, TimeInterval t)
+{
+    SubStrip *strip = &self->canvas;
+    ShinyLayerSettings *prefs = self->prefs;
+    int numPixels = strip->numPixels();
+
+    float scannerWidth = std::max(1.0f, prefs->p_tau);
+    float glowWidth = prefs->p_phi;
+
+    // Distances are Q32 pixels. The position is a hard edge, so take it from curve()
+    // itself rather than a Q16 level; it's only needed once per frame.
+    float scannerPos = curve(t) * (numPixels-1);
+    int64_t scannerPosQ = (int64_t)(scannerPos * 4294967296.0);
+    int64_t coreEnd = (int64_t)(scannerWidth / 2.0f * 4294967296.0);
+    int64_t glowEnd = glowWidth > 0 ? coreEnd + (int64_t)(glowWidth * 4294967296.0) : coreEnd;
+    int64_t invGlow = glowWidth > 0 ? (int64_t)(65536.0f / glowWidth) : 0;
+
+    for(int i = 0; i < numPixels; i++)
+    {
+        int64_t distance = ((int64_t)i << 32) - scannerPosQ;
+        if(distance < 0) distance = -distance;
+        if(distance < coreEnd) {
+            strip->set(i, prefs->mainColor);
+        } else if(distance < glowEnd) {
+            int32_t fade = constrain((int32_t)(((glowEnd - distance) * invGlow) >> 32), 0, 65535);
+            strip->set(i, scale16(prefs->secondaryColor, mul16(fade, fade)));
+        } else {
+            strip->set(i, CRGB::Black);
+        }
+    }
+}
+
+void TwinkleAnimQ16(LayerAnimation *self, TimeInterval t)
+{
+    SubStrip *strip = &self->canvas;
+    ShinyLayerSettings *prefs = self->prefs;
+    int numPixels = strip->numPixels();
+
+    float density = prefs->p_tau / 10.0f;
+    float speed = prefs->p_phi;
+
+    // The float kernel evaluates curve(t*(0.5 + F/65535*speed) + P/65535) with F and P
+    // integer hashes. Split that into a shared base phase plus F and P times per-frame
+    // unit phases; integer multiples of a Q32 turn wrap exactly like the float version.
+    uint32_t basePhase = curvePhase(t * 0.5);
+    uint32_t freqUnit = curveStep(t * speed / 65535.0);
+    uint32_t phaseUnit = curveStep(1.0 / 65535.0);
+
+    for(const TwinkleStar &star : self->twinkleTable.stars(numPixels, density))
+    {
+        uint32_t phase = basePhase + star.freq * freqUnit + star.phase * phaseUnit;
+        uint16_t level = curve16(phase);
+
+        CRGB color = star.main ? prefs->mainColor : prefs->secondaryColor;
+        strip->set(star.index, scale16(color, mul16(level, level)));
+    }
+}
+
+void ColorWipeAnimQ16(LayerAnimation *self, TimeInterval t)
+{
+    SubStrip *strip = &self->canvas;
+    ShinyLayerSettings *prefs = self->prefs;
+    int numPixels = strip->numPixels();
+
+    float cycleLen = 4.0f;
+    float phase = fmod(t / (prefs->p_tau / 10.0f + 0.5f), cycleLen);
+
+    // i/numPixels < fillAmount for exactly the first ceil(fillAmount*numPixels) pixels
+    auto filledCount = [numPixels](float fillAmount) {
+        return constrain((int)ceilf(fillAmount * numPixels), 0, numPixels);
+    };
+    auto fillRange = [strip](int from, int to, CRGB color) {
+        for(int i = from; i < to; i++) {
+            strip->set(i, color);
+        }
+    };
+
+    if(phase < 1.0f) {
+        int filled = filledCount(phase);
+        fillRange(0, filled, prefs->mainColor);
+        fillRange(filled, numPixels, CRGB::Black);
+    } else if(phase < 2.0f) {
+        strip->fill(prefs->mainColor);
+    } else if(phase < 3.0f) {
+        int filled = filledCount(phase - 2.0f);
+        fillRange(0, filled, prefs->secondaryColor);
+        fillRange(filled, numPixels, prefs->mainColor);
+    } else {
+        strip->fill(prefs->secondaryColor);
+    }
+}
+
+void GradientPulseAnimQ16(LayerAnimation *self, TimeInterval t)
+{
+    SubStrip *strip = &self->canvas;
+    ShinyLayerSettings *prefs = self->prefs;
+    int numPixels = strip->numPixels();
+    if(numPixels == 0) return;
+
+    float cycles = prefs->p_phi / 4.0f;
+    float sharpness = prefs->p_tau / 10.0f;
+    if(sharpness > 0) {
+        self->sharpnessTable.prepare(1.0f / (sharpness + 1.0f));
+    }
+
+    uint32_t phase = curvePhase(t);
+    uint32_t step = curveStep((double)cycles / numPixels);
+    for(int i = 0; i < numPixels; i++)
+    {
+        uint8_t amount = (sharpness > 0)
+            ? self->sharpnessTable.amount(curveRoot16(phase))
+            : (uint32_t)curve16(phase) * 255 / 65535;
+        strip->set(i, prefs->mainColor.lerp8(prefs->secondaryColor, amount));
+        phase += step;
+    }
+}
+
+void SparkleAnimQ16(LayerAnimation *self, TimeInterval t)
+{
+    SubStrip *strip = &self->canvas;
+    ShinyLayerSettings *prefs = self->prefs;
+    int numPixels = strip->numPixels();
+
+    float flashDuration = 0.05f + prefs->p_tau / 100.0f;
+    float density = prefs->p_phi / 20.0f;
+    CRGB bgColor = scale16(prefs->secondaryColor, level16(0.1f));
+    strip->fill(bgColor);
+
+    int slotCount = 0;
+    int slotSeeds[3];
+    uint16_t slotLevels[3];
+    for(int slot = 0; slot < 3; slot++) {
+        int timeSlot = (int)(t / flashDuration) - slot;
+        float slotStart = timeSlot * flashDuration;
+        float slotProgress = (t - slotStart) / flashDuration;
+        if(slotProgress >= 0 && slotProgress < 1.0f) {
+            float flash = (slotProgress < 0.5f)
+                ? (slotProgress * 2.0f)
+                : (2.0f - slotProgress * 2.0f);
+            if(flash > 0) {
+                slotSeeds[slotCount] = timeSlot;
+                slotLevels[slotCount] = level16(flash);
+                slotCount++;
+            }
+        }
+    }
+    sortSparkleSlots(slotSeeds, slotLevels, slotCount);
+
+    for(int slot = 0; slot < slotCount; slot++) {
+        CRGB color = scale16(prefs->mainColor, slotLevels[slot]);
+        for(uint16_t i : self->sparkleTable.flashes(slotSeeds[slot], numPixels, density)) {
+            strip->set(i, color);
+        }
+    }
+}
+
+std::vector<AnimateLayerFunc> fixedAnimationFuncs = {
+    NothingAnim,
+    OpposingWavesAnimQ16,
+    SingleWaveAnimQ16,
+    BreatheAnimQ16,
+    RainbowAnimQ16,
+    CometAnimQ16,
+    ScannerAnimQ16,
+    TwinkleAnimQ16,
+    TheaterChaseAnim, // already integer-only per pixel
+    ColorWipeAnimQ16,
+    GradientPulseAnimQ16,
+    SparkleAnimQ16,
+    NeighboursAnim, // already integer-only per pixel
+};
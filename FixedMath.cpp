@@ -0,0 +1,18 @@
+#include "FixedMath.h"
+#include <OverAnimate.h>
+#include <SubStrip.h>
+
+// First quarter of a sine wave, 0.0 to 1.0 as Q16.
+uint16_t sineQuarterTable[257];
+
+// gammaf() sampled over [0, 1] as Q16, so gamma16() never has to call it.
+uint16_t gammaTable[257];
+
+static bool fixedMathTablesBuilt = [] {
+    for(int i = 0; i <= 256; i++)
+    {
+        sineQuarterTable[i] = (uint16_t)lround(sin(i / 256.0 * M_PI / 2.0) * 65535.0);
+        gammaTable[i] = level16(gammaf(i / 256.0f));
+    }
+    return true;
+}();
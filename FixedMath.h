@@ -0,0 +1,94 @@
+#ifndef __FIXED_MATH__H
+#define __FIXED_MATH__H
+#include "FastLED.h"
+#include <math.h>
+
+// Integer counterparts of curve() and gammaf() for the per-pixel animation kernels.
+//
+// Phases are Q32 "turns": 2^32 is one full period of curve(), and stepping a phase
+// simply wraps around. Levels are Q16: 0 is 0.0f and 65535 is 1.0f.
+
+extern uint16_t sineQuarterTable[257];
+extern uint16_t gammaTable[257];
+
+// curve() multiplies by 6.28f rather than 2π, so its period is slightly longer than 1.0.
+// Keep that exact scale so fixed and float kernels stay in phase for any t.
+static const double kCurveTurnsPerUnit = 6.28f / (2.0 * M_PI);
+
+// Fractional part of x as a Q32 turn. Negative values wrap like positive ones.
+inline uint32_t turnsQ32(double x)
+{
+    return (uint32_t)(int64_t)floor((x - floor(x)) * 4294967296.0);
+}
+
+// Q32 phase at which curve16() equals curve(progress).
+inline uint32_t curvePhase(double progress)
+{
+    return turnsQ32((progress - 0.25) * kCurveTurnsPerUnit);
+}
+
+// Q32 phase increment equivalent to adding delta to curve()'s input.
+inline uint32_t curveStep(double delta)
+{
+    return turnsQ32(delta * kCurveTurnsPerUnit);
+}
+
+// Interpolated lookup into a 257-entry table sampled over [0, 1].
+inline uint16_t lerpTable(const uint16_t *table, uint16_t x)
+{
+    uint8_t idx = x >> 8;
+    uint8_t frac = x & 0xFF;
+    int32_t a = table[idx];
+    int32_t b = table[idx + 1];
+    return a + (((b - a) * frac) >> 8);
+}
+
+// curve16(curvePhase(p)) is curve(p) as a Q16 level.
+inline uint16_t curve16(uint32_t phase)
+{
+    uint16_t inQuadrant = (phase >> 14) & 0xFFFF;
+    uint8_t quadrant = phase >> 30;
+    if(quadrant & 1) inQuadrant = 0xFFFF - inQuadrant;
+    uint32_t s = lerpTable(sineQuarterTable, inQuadrant);
+    return (quadrant & 2) ? (65535 - s) >> 1 : (65535 + s) >> 1;
+}
+
+// Square root of curve16(), as a Q16 level. curve() is sin^2 shifted by a quarter turn,
+// so this is a plain table lookup, and squaring it keeps far more precision near zero
+// than curve16() itself can.
+inline uint16_t curveRoot16(uint32_t phase)
+{
+    phase += 1u << 30;
+    uint16_t inQuadrant = (phase >> 15) & 0xFFFF;
+    if(phase >> 31) inQuadrant = 0xFFFF - inQuadrant;
+    return lerpTable(sineQuarterTable, inQuadrant);
+}
+
+// gammaf() on a Q16 level.
+inline uint16_t gamma16(uint16_t level)
+{
+    return lerpTable(gammaTable, level);
+}
+
+// Q16 multiply of two levels, with 65535 * 65535 == 65535.
+inline uint16_t mul16(uint16_t a, uint16_t b)
+{
+    return ((uint32_t)a * (b + 1)) >> 16;
+}
+
+// Scales a color by a Q16 level; a level of 65535 leaves it untouched.
+inline CRGB scale16(const CRGB &c, uint16_t level)
+{
+    uint32_t l = (uint32_t)level + 1;
+    return CRGB((c.r * l) >> 16, (c.g * l) >> 16, (c.b * l) >> 16);
+}
+
+// Converts a float in [0, 1] to a Q16 level, clamping anything outside.
+inline uint16_t level16(float f)
+{
+    if(!(f > 0)) return 0;
+    if(f >= 1.0f) return 65535;
+    return (uint16_t)(f * 65535.0f);
+}
+
+#endif
@@ -0,0 +1,172 @@
+#include "GoldenFrames.h"
+#include "Compositor.h"
+#include "Animations.h"
+#include <vector>
+
+struct GoldenFrame
+{
+    const char *kind;
+    const char *name;
+    uint32_t hash;
+};
+
+// Captured with the host build; see GoldenFrames.h.
+static const GoldenFrame kGoldenFrames[] = {
+    { "blend", "Add", 0x714f7272 },
+    { "blend", "Subtract", 0xf4ec1ac5 },
+    { "blend", "Add Wrap", 0x7f5ceda1 },
+    { "blend", "Subtract Wrap", 0x1ec4fb39 },
+    { "blend", "Multiply", 0xaea702d0 },
+    { "blend", "Average", 0x04d33066 },
+    { "blend", "Set", 0xf6419b41 },
+    { "blend", "Screen", 0x7eeb948a },
+    { "blend", "Lighten", 0x3636e9cf },
+    { "blend", "Darken", 0x6d3d79c5 },
+    { "blend", "Difference", 0xb89d6921 },
+    { "blend", "Overlay", 0xaf185dae },
+    { "blend", "Color Dodge", 0x2d90229e },
+    { "animation", "Opposing Waves", 0x01404129 },
+    { "animation", "Single Wave", 0x47a79436 },
+    { "animation", "Breathe", 0xe46b3985 },
+    { "animation", "Rainbow", 0x8ff30a0b },
+    { "animation", "Comet", 0xb8bb9cf2 },
+    { "animation", "Scanner", 0x308ad7a7 },
+    { "animation", "Twinkle", 0x28d6e45d },
+    { "animation", "Theater Chase", 0x473fc589 },
+    { "animation", "Color Wipe", 0x397fc69a },
+    { "animation", "Gradient Pulse", 0x8056f662 },
+    { "animation", "Sparkle", 0x8c8edd5d },
+    { "animation", "Neighbours", 0xc3b007b7 },
+    { "animation_fixed", "Opposing Waves", 0xa006fe3b },
+    { "animation_fixed", "Single Wave", 0x526d83b7 },
+    { "animation_fixed", "Breathe", 0xe46b3985 },
+    { "animation_fixed", "Rainbow", 0x6ec514bf },
+    { "animation_fixed", "Comet", 0xb8bb9cf2 },
+    { "animation_fixed", "Scanner", 0x308ad7a7 },
+    { "animation_fixed", "Twinkle", 0x530aa161 },
+    { "animation_fixed", "Theater Chase", 0x473fc589 },
+    { "animation_fixed", "Color Wipe", 0x397fc69a },
+    { "animation_fixed", "Gradient Pulse", 0x1b4b91eb },
+    { "animation_fixed", "Sparkle", 0x8c8edd5d },
+    { "animation_fixed", "Neighbours", 0xc3b007b7 },
+};
+
+static const TimeInterval kGoldenTimes[] = { 0, 0.5, 3.25, 17 };
+static const float kGoldenParameters[][2] = { {10, 4}, {-3, 0.5}, {42, -7} }; // tau, phi
+static const int kGoldenPixels = 64;
+static const uint8_t kGoldenLevels[] = { 0, 1, 64, 127, 128, 200, 254, 255 };
+
+uint32_t hashPixels(const uint8_t *bytes, int count, uint32_t hash)
+{
+    for(int i = 0; i < count; i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t hashAnimation(int animation, bool fixedPoint)
+{
+    std::vector<CRGB> front(kGoldenPixels);
+    std::vector<CRGB> back(kGoldenPixels);
+    SubStrip frontbuffer(front.data(), kGoldenPixels);
+    SubStrip backbuffer(back.data(), kGoldenPixels);
+    NeighbourColors neighbours;
+    neighbours.count = 2;
+    neighbours.colors[0] = CRGB(255, 0, 0);
+    neighbours.colors[1] = CRGB(0, 0, 255);
+
+    uint32_t hash = 2166136261u;
+    for(const float *parameters : kGoldenParameters)
+    {
+        ShinyLayerSettings prefs;
+        prefs.animationIndex = animation;
+        prefs.fixedPoint = fixedPoint;
+        prefs.blendMode = BlendModeSet;
+        prefs.p_tau = parameters[0];
+        prefs.p_phi = parameters[1];
+        // a fresh layer for each set of parameters, so tables and state start out the same
+        LayerAnimation layer(&backbuffer, &frontbuffer, &prefs);
+        layer.neighbours = &neighbours;
+        for(TimeInterval t : kGoldenTimes)
+        {
+            frontbuffer.fill(CRGB::Black);
+            layer.advance(t, 1);
+            layer.render();
+            hash = hashPixels((const uint8_t*)front.data(), kGoldenPixels * sizeof(CRGB), hash);
+        }
+    }
+    return hash;
+}
+
+static uint32_t hashBlendMode(LayerBlendMode mode)
+{
+    // Every pair of levels meets in red and green, and some of them in blue
+    const int levels = sizeof(kGoldenLevels);
+    alignas(4) CRGB dst[levels * levels + 1];
+    alignas(4) CRGB src[levels * levels + 1];
+    BlendSpanFunc blend = blendSpanFor(mode);
+    uint32_t hash = 2166136261u;
+    for(int offset = 0; offset < 2; offset++)
+    {
+        for(int i = 0; i < levels; i++)
+        {
+            for(int j = 0; j < levels; j++)
+            {
+                dst[offset + i*levels + j] = CRGB(kGoldenLevels[i], kGoldenLevels[j], kGoldenLevels[(i + j) % levels]);
+                src[offset + i*levels + j] = CRGB(kGoldenLevels[j], kGoldenLevels[i], kGoldenLevels[(3*i + j) % levels]);
+            }
+        }
+        // offset 1 isn't word aligned, which takes the packed kernels' byte-by-byte edges
+        blend(dst + offset, src + offset, levels * levels - offset);
+        hash = hashPixels((const uint8_t*)(dst + offset), (levels * levels - offset) * sizeof(CRGB), hash);
+    }
+    return hash;
+}
+
+// Calls visit(kind, name, hash) for every case
+template<typename Visitor>
+static void forEachGoldenFrame(Visitor visit)
+{
+    for(int mode = 0; mode < BlendModeCount; mode++)
+    {
+        if(mode == BlendModeDissolve) continue;
+        visit("blend", blendModeNames[mode].c_str(), hashBlendMode((LayerBlendMode)mode));
+    }
+    for(int fixedPoint = 0; fixedPoint < 2; fixedPoint++)
+    {
+        for(size_t animation = 1; animation < animationFuncs.size(); animation++)
+        {
+            visit(fixedPoint ? "animation_fixed" : "animation", animationNames[animation].c_str(), hashAnimation(animation, fixedPoint));
+        }
+    }
+}
+
+int checkGoldenFrames(Print &out)
+{
+    int cases = 0, missing = 0, failures = 0;
+    forEachGoldenFrame([&](const char *kind, const char *name, uint32_t hash) {
+        cases++;
+        for(const GoldenFrame &golden : kGoldenFrames)
+        {
+            if(strcmp(golden.kind, kind) != 0 || strcmp(golden.name, name) != 0) continue;
+            if(golden.hash != hash)
+            {
+                out.printf("golden mismatch: %s %s is %08x, expected %08x\n", kind, name, hash, golden.hash);
+                failures++;
+            }
+            return;
+        }
+        out.printf("no golden for %s %s (%08x)\n", kind, name, hash);
+        missing++;
+    });
+    out.printf("goldens: %d cases, %d mismatched, %d without a golden\n", cases, failures, missing);
+    return failures + missing;
+}
+
+void captureGoldenFrames(Print &out)
+{
+    forEachGoldenFrame([&](const char *kind, const char *name, uint32_t hash) {
+        out.printf("    { \"%s\", \"%s\", 0x%08x },\n", kind, name, hash);
+    });
+}
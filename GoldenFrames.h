@@ -0,0 +1,29 @@
+#ifndef __GOLDEN_FRAMES__H
+#define __GOLDEN_FRAMES__H
+#include <Arduino.h>
+
+// Known-good hashes of what the render kernels draw, so that optimizing one can be checked
+// for changing how it looks.
+//
+// Each animation is rendered with each kernel (float and fixed point) at a set of fixed
+// times and tau/phi values, and each blend mode over a grid of input colors, aligned and
+// misaligned. Every case's pixels are folded into one hash per animation and kernel, or
+// per blend mode; Dissolve is random by design and left out.
+//
+// make -C host test checks them on every build. When a kernel is meant to change how it
+// looks, run host/build/GoldenFramesTest capture and paste its output into kGoldenFrames
+// in GoldenFrames.cpp. The float kernels go through the math library, whose last bits can
+// differ between platforms, so on the device ("goldens check" over serial) only the
+// blend modes and fixed-point animations are sure to match.
+
+// Folds count pixels into hash (FNV-1a over their bytes)
+uint32_t hashPixels(const uint8_t *bytes, int count, uint32_t hash = 2166136261u);
+
+// Renders every case and compares it against the goldens, printing a line for each one
+// that's different or has no golden. Returns how many were either.
+int checkGoldenFrames(Print &out);
+
+// Prints every case's hash as a kGoldenFrames entry
+void captureGoldenFrames(Print &out);
+
+#endif
@@ -1,53 +1,93 @@
 #include "LayerAnimation.h"
 #include "Animations.h"
+#include "Compositor.h"
+#include "Telemetry.h"
+#include <esp_timer.h>
 
-void LayerAnimation::animate(float fraction) 
+void LayerAnimation::advance(TimeInterval masterTime, float tempo, bool sharedClock)
 {
-    // if we wrap over to 0, assume another full second has passed
-    if(fraction < _lastFraction)
+    if(sharedClock || _tempo < 0)
     {
-        _accumulated += 1.0;
+        _baseTime = 0;
+        _baseMasterTime = 0;
     }
-    _lastFraction = fraction;
-    TimeInterval absoluteTime = _accumulated + fraction;
-
-    AnimateLayerFunc func = animationFuncs[prefs->animationIndex];
-    backbuffer->fill(CRGB::Black);
+    else if(tempo != _tempo)
+    {
+        _baseTime = _time;
+        _baseMasterTime = masterTime;
+    }
+    _tempo = tempo;
+    _time = _baseTime + (masterTime - _baseMasterTime) * _tempo;
+}
 
-    if(prefs->animationIndex == 0) return; // NoAnimation? do nothing, don't waste time filling and blending.
+void LayerAnimation::continueFrom(const LayerAnimation &other)
+{
+    _tempo = other._tempo;
+    _baseTime = other._baseTime;
+    _baseMasterTime = other._baseMasterTime;
+    _time = other._time;
+    _rendered = false;
+}
 
-    func(this, absoluteTime); 
+double LayerAnimation::frameKey()
+{
+    return animationFrameKeys[prefs->animationIndex](this, _time);
+}
 
-    for(int i = 0; i < frontbuffer->numPixels(); i++)
+void LayerAnimation::window(int &start, int &count)
+{
+    int pixels = frontbuffer->numPixels();
+    start = 0;
+    count = pixels;
+    if(segments && prefs->segment > 0 && prefs->segment <= SEGMENT_COUNT)
+    {
+        const LedSegment &segment = segments[prefs->segment - 1];
+        start = min((int)segment.start, pixels);
+        count = min((int)segment.count, pixels - start);
+    }
+    if(outputs && count > 0)
     {
-        CRGB a = (*frontbuffer)[i]; // current contents on the strip
-        CRGB b = (*backbuffer)[i]; // this layer's new content to be blended in
-
-        CRGB blended;
-        switch(prefs->blendMode) {
-            case BlendModeAdd: default: blended = a + b; break;
-            case BlendModeSubtract: blended = a - b; break;
-            case BlendModeAddWrap: blended = CRGB((a.r + b.r) & 0xFF, (a.g + b.g) & 0xFF, (a.b + b.b) & 0xFF); break;
-            case BlendModeSubtractWrap: blended = CRGB((a.r - b.r) & 0xFF, (a.g - b.g) & 0xFF, (a.b - b.b) & 0xFF); break;
-            case BlendModeMultiply: blended = CRGB((a.r * b.r) >> 8, (a.g * b.g) >> 8, (a.b * b.b) >> 8); break;
-            case BlendModeDissolve: blended = random8() < 128 ? a : b; break;
-            case BlendModeAverage: blended = CRGB((a.r + b.r) >> 1, (a.g + b.g) >> 1, (a.b + b.b) >> 1); break;
-            case BlendModeSet: blended = b; break;
-            case BlendModeScreen: blended = CRGB(255 - (((255-a.r) * (255-b.r)) >> 8),
-                                                 255 - (((255-a.g) * (255-b.g)) >> 8),
-                                                 255 - (((255-a.b) * (255-b.b)) >> 8)); break;
-            case BlendModeLighten: blended = CRGB(max(a.r, b.r), max(a.g, b.g), max(a.b, b.b)); break;
-            case BlendModeDarken: blended = CRGB(min(a.r, b.r), min(a.g, b.g), min(a.b, b.b)); break;
-            case BlendModeDifference: blended = CRGB(abs(a.r - b.r), abs(a.g - b.g), abs(a.b - b.b)); break;
-            case BlendModeOverlay: blended = CRGB(
-                a.r < 128 ? (2 * a.r * b.r) >> 8 : 255 - ((2 * (255-a.r) * (255-b.r)) >> 8),
-                a.g < 128 ? (2 * a.g * b.g) >> 8 : 255 - ((2 * (255-a.g) * (255-b.g)) >> 8),
-                a.b < 128 ? (2 * a.b * b.b) >> 8 : 255 - ((2 * (255-a.b) * (255-b.b)) >> 8)); break;
-            case BlendModeColorDodge: blended = CRGB(
-                b.r == 255 ? 255 : min(255, (a.r << 8) / (255 - b.r)),
-                b.g == 255 ? 255 : min(255, (a.g << 8) / (255 - b.g)),
-                b.b == 255 ? 255 : min(255, (a.b << 8) / (255 - b.b))); break;
+        bool shown = false;
+        for(int i = 0; i < LED_OUTPUT_COUNT; i++)
+        {
+            const LedOutputMap &output = outputs[i];
+            shown |= output.count > 0 && output.start < start + count && start < output.start + output.count;
         }
-        frontbuffer->set(i, blended);
+        if(!shown) count = 0;
     }
 }
+
+bool LayerAnimation::needsRender()
+{
+    if(!_rendered) return true;
+    if(prefs->blendMode == BlendModeDissolve && prefs->animationIndex != 0) return true; // random every frame
+    int start, count;
+    window(start, count);
+    if(_renderedStart != start || _renderedPixels != count) return true;
+    if(_renderedPrefs != *prefs) return true;
+
+    double key = frameKey();
+    return !(key == _renderedKey || (key != key && _renderedKey != _renderedKey));
+}
+
+void LayerAnimation::render()
+{
+    _rendered = true;
+    _renderedPrefs = *prefs;
+    window(_renderedStart, _renderedPixels);
+    canvas = SubStrip(&(*backbuffer)[_renderedStart], _renderedPixels);
+    _renderedKey = frameKey();
+
+    if(prefs->animationIndex == 0) return; // NoAnimation? do nothing, don't waste time filling and blending.
+    if(_renderedPixels == 0) return; // nor if its segment is empty
+
+    AnimateLayerFunc func = (prefs->fixedPoint ? fixedAnimationFuncs : animationFuncs)[prefs->animationIndex];
+    canvas.fill(CRGB::Black);
+
+    func(this, _time);
+
+    int64_t started = esp_timer_get_time();
+    BlendSpanFunc blend = blendSpanFor(prefs->blendMode);
+    blend(&(*frontbuffer)[_renderedStart], &canvas[0], _renderedPixels);
+    telemetry.recordSince(StageBlend, started);
+}
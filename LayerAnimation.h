@@ -3,25 +3,73 @@
 #include <OverAnimate.h>
 #include <SubStrip.h>
 #include "ShinyTypes.h"
+#include "PixelTables.h"
 
-class LayerAnimation : public Animation
+class LayerAnimation
 {
 public:
     SubStrip *backbuffer;
     SubStrip *frontbuffer;
     ShinyLayerSettings *prefs;
+    // Other cores' colors, for the animations that use them; the whole strip gets
+    // recomposited when they change, so they don't count towards needsRender()
+    const NeighbourColors *neighbours;
+    // The segments prefs->segment picks from; NULL means layers always cover the whole strip
+    const LedSegment *segments;
+    // The LED_OUTPUT_COUNT outputs of a mapped layout, or NULL if every pixel is shown. A
+    // layer none of them shows any of is skipped; one they show any of is drawn whole,
+    // unmapped pixels included, since its animation is laid out over all of its segment
+    const LedOutputMap *outputs;
+    // What animations draw into: the part of backbuffer for this layer's segment
+    SubStrip canvas;
+    // Per-pixel constants for the animations that need them; empty until first used
+    TwinkleTable twinkleTable;
+    SparkleTable sparkleTable;
+    SharpnessTable sharpnessTable;
     LayerAnimation(SubStrip *backbuffer, SubStrip *frontbuffer, ShinyLayerSettings *prefs) 
-      : Animation(1.0, true), backbuffer(backbuffer), frontbuffer(frontbuffer), prefs(prefs), _accumulated(0), _lastFraction(1)
+      : backbuffer(backbuffer), frontbuffer(frontbuffer), prefs(prefs), neighbours(NULL), segments(NULL), outputs(NULL), canvas(NULL, 0), _tempo(-1), _baseTime(0), _baseMasterTime(0), _time(0), _rendered(false)
       {}
+
+    // Moves this layer's time to where it is at the given AnimationClock time, running
+    // tempo times as fast as the clock. On a shared clock that's just masterTime * tempo,
+    // so every core with the same clock and settings draws the same frame. Otherwise a
+    // tempo change takes effect from the current time on, so the animation speeds up or
+    // slows down rather than jumping.
+    void advance(TimeInterval masterTime, float tempo, bool sharedClock = false);
+    // Picks up other's time, as if this layer had been running alongside it all along.
+    void continueFrom(const LayerAnimation &other);
+
+    // True if render() would draw something different from what it drew last time.
+    bool needsRender();
+    // Draws this layer at the current time into backbuffer and blends it onto frontbuffer.
+    void render();
 protected:
-    void animate(float fraction);
+    // _time is _baseTime plus _tempo times the master time since _baseMasterTime; the
+    // base only moves off 0 on tempo changes on an unshared clock. _tempo is -1 before
+    // the first advance().
+    float _tempo;
+    TimeInterval _baseTime;
+    TimeInterval _baseMasterTime;
+    TimeInterval _time;
 
-    // xx hack: I thought animate took time, but it actually takes fraction. calculate time so we can keep it accumulating
-    TimeInterval _accumulated;
-    float _lastFraction;
+    // What the last render() was drawn from
+    bool _rendered;
+    ShinyLayerSettings _renderedPrefs;
+    int _renderedStart;
+    int _renderedPixels;
+    double _renderedKey;
+    double frameKey();
+
+    // The pixels of frontbuffer this layer covers, clipped to it; none if no output shows
+    // any of them, and all of them otherwise
+    void window(int &start, int &count);
 };
 
 typedef void(*AnimateLayerFunc)(LayerAnimation*, TimeInterval);
 
+// Identifies what an animation draws at time t, for the current prefs: two times with the
+// same key must draw the same frame. Anything that moves with time can just return t.
+typedef double(*AnimationFrameKeyFunc)(LayerAnimation*, TimeInterval);
+
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,69 @@
+#include "LedOutput.h"
+#include "Telemetry.h"
+#include <esp_timer.h>
+
+void LedOutput::begin(CLEDController **strips, int stripCount, int core, int priority)
+{
+    _stripCount = min(stripCount, (int)(sizeof(_strips)/sizeof(_strips[0])));
+    for(int i = 0; i < _stripCount; i++)
+    {
+        _strips[i] = strips[i];
+    }
+
+    _free = xQueueCreate(2, sizeof(uint8_t));
+    _pending = xQueueCreate(2, sizeof(PendingFrame));
+    for(uint8_t i = 0; i < 2; i++)
+    {
+        xQueueSend(_free, &i, 0);
+    }
+    xTaskCreatePinnedToCore(outputTask, "ledOutput", 4096, this, priority, NULL, core);
+}
+
+CRGB *LedOutput::beginFrame()
+{
+    int64_t start = esp_timer_get_time();
+    xQueueReceive(_free, &_current, portMAX_DELAY);
+    uint32_t waited = esp_timer_get_time() - start;
+
+    _pacedFrames++;
+    _waitMicros += waited;
+    uint32_t maxWait = _maxWaitMicros;
+    if(waited > maxWait) _maxWaitMicros = waited;
+
+    return _frames[_current];
+}
+
+void LedOutput::commitFrame(const OutputSpan *spans)
+{
+    PendingFrame frame = { _current };
+    memcpy(frame.spans, spans, _stripCount * sizeof(OutputSpan));
+    xQueueSend(_pending, &frame, portMAX_DELAY);
+}
+
+FramePacing LedOutput::takePacing()
+{
+    FramePacing pacing;
+    pacing.frames = _pacedFrames.exchange(0);
+    pacing.waitMicros = _waitMicros.exchange(0);
+    pacing.maxWaitMicros = _maxWaitMicros.exchange(0);
+    return pacing;
+}
+
+void LedOutput::outputTask(void *param)
+{
+    LedOutput *self = (LedOutput*)param;
+    PendingFrame frame;
+    for(;;)
+    {
+        xQueueReceive(self->_pending, &frame, portMAX_DELAY);
+        CRGB *pixels = self->_frames[frame.index];
+        for(int i = 0; i < self->_stripCount; i++)
+        {
+            self->_strips[i]->setLeds(pixels + frame.spans[i].start, frame.spans[i].count);
+        }
+        int64_t started = esp_timer_get_time();
+        FastLED.show(); // blocks this task until the transfer is done, not the renderer
+        telemetry.recordSince(StageShow, started);
+        xQueueSend(self->_free, &frame.index, portMAX_DELAY);
+    }
+}
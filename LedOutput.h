@@ -0,0 +1,66 @@
+#ifndef __LED_OUTPUT__H
+#define __LED_OUTPUT__H
+#include "FastLED.h"
+#include "ShinyTypes.h"
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+// How much of the frame budget the render task spent blocked on LED output.
+struct FramePacing
+{
+    uint32_t frames;
+    uint32_t waitMicros;
+    uint32_t maxWaitMicros;
+};
+
+// The part of a transmit buffer one strip shows
+struct OutputSpan
+{
+    uint16_t start;
+    uint16_t count;
+};
+
+// Double-buffered LED output. FastLED.show() blocks for as long as it takes to clock the
+// strip out (about 24ms for 800 WS2811 pixels), so it runs in a task of its own: while
+// one transmit buffer is being sent, the render task fills the other one with the next
+// frame, and only has to wait if it gets a whole frame ahead.
+class LedOutput
+{
+public:
+    LedOutput() : _stripCount(0) {}
+
+    // strips all show parts of the same transmit buffer; the output task runs on core at
+    // priority.
+    void begin(CLEDController **strips, int stripCount, int core, int priority);
+
+    // Render task: waits for a free transmit buffer and returns it.
+    CRGB *beginFrame();
+    // Render task: queues the buffer from beginFrame() to be shown, with spans saying
+    // which of its pixels go to each strip (one per strip given to begin()). Strips with
+    // spans of their own transmit in parallel.
+    void commitFrame(const OutputSpan *spans);
+
+    // Pacing since the last call
+    FramePacing takePacing();
+private:
+    struct PendingFrame
+    {
+        uint8_t index;
+        OutputSpan spans[LED_OUTPUT_COUNT];
+    };
+    static void outputTask(void *param);
+
+    alignas(4) CRGB _frames[2][MAX_LED_COUNT];
+    CLEDController *_strips[LED_OUTPUT_COUNT];
+    int _stripCount;
+    QueueHandle_t _free;
+    QueueHandle_t _pending;
+    uint8_t _current;
+
+    std::atomic<uint32_t> _pacedFrames;
+    std::atomic<uint32_t> _waitMicros;
+    std::atomic<uint32_t> _maxWaitMicros;
+};
+
+#endif
@@ -0,0 +1,168 @@
+#include "OutputStage.h"
+
+static const uint8_t kColorOrders[LedOrderCount][3] = {
+    { 0, 1, 2 }, // RGB
+    { 1, 0, 2 }, // GRB
+    { 2, 1, 0 }, // BGR
+};
+
+// The 8 bit level to show for an 8.8 one, carrying what's cut off over to the next frame
+static inline uint8_t diffuse(uint16_t level, uint8_t &residual)
+{
+    uint32_t exact = level + residual;
+    if(exact >= 0xFF00)
+    {
+        // already at full; there's nothing brighter to make up the difference with
+        residual = 0;
+        return 255;
+    }
+    residual = exact & 0xFF;
+    return exact >> 8;
+}
+
+static inline LedColorOrder validOrder(LedColorOrder order)
+{
+    return (order >= 0 && order < LedOrderCount) ? order : LedOrderRGB;
+}
+
+static bool sameOutputs(const LedOutputMap *a, const LedOutputMap *b)
+{
+    for(int i = 0; i < LED_OUTPUT_COUNT; i++)
+    {
+        if(a[i].start != b[i].start || a[i].count != b[i].count || a[i].reversed != b[i].reversed || a[i].colorOrder != b[i].colorOrder) return false;
+    }
+    return true;
+}
+
+bool OutputStage::configure(const ShinySettings &settings)
+{
+    if(_configured
+        && settings.mode == _mode
+        && settings.brightness == _brightness
+        && settings.whiteBalance == _whiteBalance
+        && settings.outputGamma == _gamma
+        && settings.dither == _dither
+        && settings.ledColorOrder == _colorOrder
+        && settings.ledLayout == _layout
+        && sameOutputs(settings.outputs, _outputs))
+    {
+        return false;
+    }
+    _configured = true;
+    _mode = settings.mode;
+    _brightness = settings.brightness;
+    _whiteBalance = settings.whiteBalance;
+    _gamma = settings.outputGamma > 0 ? settings.outputGamma : 1.0f;
+    _dither = settings.dither;
+    _colorOrder = settings.ledColorOrder;
+    _layout = settings.ledLayout;
+    memcpy(_outputs, settings.outputs, sizeof(_outputs));
+
+    for(int output = 0; output < LED_OUTPUT_COUNT; output++)
+    {
+        LedColorOrder order = _layout == LedLayoutMapped ? _outputs[output].colorOrder : _colorOrder;
+        memcpy(_orders[output], kColorOrders[validOrder(order)], sizeof(_orders[output]));
+    }
+
+    float brightness = (_mode == Off ? 0 : _brightness) / 255.0f;
+    bool fractions = false;
+    for(int channel = 0; channel < 3; channel++)
+    {
+        float scale = 255.0f * 256.0f * brightness * _whiteBalance.raw[channel] / 255.0f;
+        for(int level = 0; level < 256; level++)
+        {
+            float linear = _gamma == 1.0f ? level / 255.0f : powf(level / 255.0f, _gamma);
+            uint16_t value = lroundf(scale * linear);
+            _tables[channel][level] = value;
+            fractions |= (value & 0xFF) != 0;
+        }
+    }
+    bool wasDithering = _dithering;
+    _dithering = _dither && fractions;
+    if(_dithering && !wasDithering)
+    {
+        // Start every channel at a different point of its cycle, or a whole strip of the
+        // same level would blink on and off in unison
+        for(int i = 0; i < MAX_LED_COUNT * 3; i++)
+        {
+            _residuals[i] = i * 149;
+        }
+    }
+    return true;
+}
+
+void OutputStage::write(CRGB *transmit, const CRGB *strip, const ShinySettings &settings)
+{
+    int count = constrain(settings.ledCount, 0, MAX_LED_COUNT);
+    int half = count / 2;
+    uint8_t *out = (uint8_t*)transmit;
+    switch(_layout) {
+        case LedLayoutSplit:
+            route(out, 0, strip, 0, half, false, 0);
+            route(out, half, strip, half, count - half, false, 1);
+            break;
+        case LedLayoutSplitFromCenter:
+            route(out, 0, strip, 0, half, true, 0);
+            route(out, half, strip, half, count - half, false, 1);
+            break;
+        case LedLayoutSplitFolded:
+            route(out, 0, strip, 0, half, false, 0);
+            route(out, half, strip, half, count - half, true, 1);
+            break;
+        case LedLayoutMapped:
+        {
+            int sent = 0;
+            for(int output = 0; output < LED_OUTPUT_COUNT; output++)
+            {
+                const LedOutputMap &map = _outputs[output];
+                int start = min((int)map.start, count);
+                int pixels = min(min((int)map.count, count - start), MAX_LED_COUNT - sent);
+                route(out, sent, strip, start, pixels, map.reversed, output);
+                sent += pixels;
+            }
+            break;
+        }
+        default:
+            // every output shows the same pixels
+            route(out, 0, strip, 0, count, false, 0);
+            for(int output = 1; output < LED_OUTPUT_COUNT; output++)
+            {
+                _spans[output] = _spans[0];
+            }
+            break;
+    }
+}
+
+void OutputStage::route(uint8_t *transmit, int at, const CRGB *strip, int start, int count, bool reversed, int output)
+{
+    _spans[output] = { (uint16_t)at, (uint16_t)count };
+    if(count <= 0) return;
+    // reversed spans are filled from their end backwards
+    int first = reversed ? at + count - 1 : at;
+    writeSpan(transmit + first * 3, _residuals + first * 3, reversed ? -3 : 3, strip + start, count, _orders[output]);
+}
+
+void OutputStage::writeSpan(uint8_t *transmit, uint8_t *residuals, int step, const CRGB *strip, int count, const uint8_t *order)
+{
+    const uint16_t *tables[3] = { _tables[order[0]], _tables[order[1]], _tables[order[2]] };
+    const uint8_t *in = (const uint8_t*)strip;
+    uint8_t first = order[0], second = order[1], third = order[2];
+
+    if(!_dithering)
+    {
+        for(int i = 0; i < count; i++, in += 3, transmit += step)
+        {
+            transmit[0] = tables[0][in[first]] >> 8;
+            transmit[1] = tables[1][in[second]] >> 8;
+            transmit[2] = tables[2][in[third]] >> 8;
+        }
+        return;
+    }
+
+    for(int i = 0; i < count; i++, in += 3, residuals += step, transmit += step)
+    {
+        transmit[0] = diffuse(tables[0][in[first]], residuals[first]);
+        transmit[1] = diffuse(tables[1][in[second]], residuals[second]);
+        transmit[2] = diffuse(tables[2][in[third]], residuals[third]);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef __OUTPUT_STAGE__H
+#define __OUTPUT_STAGE__H
+#include "FastLED.h"
+#include "ShinyTypes.h"
+#include "LedOutput.h"
+
+// Turns a composited frame into what's sent to the strips, in one pass over its pixels:
+// each channel goes through a 256-entry table of gamma x white balance x brightness, gets
+// temporally dithered, and lands in the strip's color order and the LED layout's place
+// in the transmit buffer. The composited frame itself is only read, never changed.
+//
+// Table entries keep 8 bits of fraction, which is what dimmed levels lose when cut to 8
+// bits: at 20% brightness, input levels 1-5 would all come out as 0 or 1. Dithering keeps
+// each pixel's leftover fraction and adds it to its next frame, so over a few frames the
+// LED averages the exact level, and fades don't step. That costs one byte per channel,
+// 2400 bytes at MAX_LED_COUNT, instead of doubling every frame buffer to 16 bits.
+//
+// FastLED is left at full brightness with its own dithering off, since both happen here.
+class OutputStage
+{
+public:
+    OutputStage() : _dithering(false), _spans(), _configured(false) {}
+
+    // Rebuilds the tables if the output settings changed; returns true if they did, so
+    // the frame has to be sent again even though the composite didn't change.
+    bool configure(const ShinySettings &settings);
+
+    // True if the tables have fractions to dither, so that even an unchanged frame is
+    // worth sending again: it'll come out slightly different
+    bool dithering() const { return _dithering; }
+
+    // Writes settings.ledCount pixels of strip to transmit, laid out for the LED layout.
+    // Split layouts put GROVE1's half first and GROVE2's second; Mapped puts each
+    // output's pixels after the previous output's, as many as fit in MAX_LED_COUNT.
+    void write(CRGB *transmit, const CRGB *strip, const ShinySettings &settings);
+    // Where the last write() put each output's pixels, for LedOutput::commitFrame()
+    const OutputSpan *spans() const { return _spans; }
+private:
+    // Writes count pixels of strip, from start, to transmit from pixel at on, for output
+    void route(uint8_t *transmit, int at, const CRGB *strip, int start, int count, bool reversed, int output);
+    void writeSpan(uint8_t *transmit, uint8_t *residuals, int step, const CRGB *strip, int count, const uint8_t *order);
+
+    // Output level of each input level per channel, in 8.8 fixed point
+    uint16_t _tables[3][256];
+    // transmit channel i of an output comes from composited channel _orders[output][i]
+    uint8_t _orders[LED_OUTPUT_COUNT][3];
+    bool _dithering;
+    // Fraction of each transmitted LED's channels not yet shown, 1/256ths, in composited
+    // channel order so switching color order doesn't shuffle them between channels
+    uint8_t _residuals[MAX_LED_COUNT * 3];
+    OutputSpan _spans[LED_OUTPUT_COUNT];
+
+    // What the tables were built from
+    bool _configured;
+    RunMode _mode;
+    uint8_t _brightness;
+    CRGB _whiteBalance;
+    float _gamma;
+    bool _dither;
+    LedColorOrder _colorOrder;
+    LedLayout _layout;
+    LedOutputMap _outputs[LED_OUTPUT_COUNT];
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include "PixelTables.h"
+#include "Util.h"
+
+const std::vector<TwinkleStar> &TwinkleTable::stars(int numPixels, float density)
+{
+    if(numPixels == _numPixels && density == _density) return _stars;
+    _numPixels = numPixels;
+    _density = density;
+
+    _stars.clear();
+    for(int i = 0; i < numPixels; i++)
+    {
+        if(hashFloat(i * 11111) > density) continue;
+
+        TwinkleStar star;
+        star.index = i;
+        star.phase = hash(i * 12345) & 0xFFFF;
+        star.freq = hash(i * 67890) & 0xFFFF;
+        star.main = hash(i) & 1;
+        _stars.push_back(star);
+    }
+    return _stars;
+}
+
+const std::vector<uint16_t> &SparkleTable::flashes(int32_t timeSlot, int numPixels, float density)
+{
+    if(numPixels != _numPixels || density != _density)
+    {
+        _numPixels = numPixels;
+        _density = density;
+        for(int i = 0; i < kSlots; i++) _slots[i] = INT32_MIN;
+    }
+
+    // Time moves forward, so the earliest slot is the one least likely to be asked for again
+    int oldest = 0;
+    for(int i = 0; i < kSlots; i++)
+    {
+        if(_slots[i] == timeSlot) return _flashes[i];
+        if(_slots[i] < _slots[oldest]) oldest = i;
+    }
+
+    std::vector<uint16_t> &flashes = _flashes[oldest];
+    _slots[oldest] = timeSlot;
+
+    flashes.clear();
+    for(int i = 0; i < numPixels; i++)
+    {
+        float chance = (hash(i * 99999 + timeSlot) & 0xFFFF) / 65535.0f;
+        if(chance < density) flashes.push_back(i);
+    }
+    return flashes;
+}
+
+void SharpnessTable::prepare(float exponent)
+{
+    if(exponent == _exponent) return;
+    _exponent = exponent;
+    _thresholds.resize(256);
+    _thresholds[0] = 0;
+    for(int j = 1; j < 256; j++)
+    {
+        _thresholds[j] = (uint16_t)ceil(pow(j / 255.0, 0.5 / exponent) * 65535.0);
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef __PIXEL_TABLES__H
+#define __PIXEL_TABLES__H
+#include <Arduino.h>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+// Per-pixel constants for the hash-based animations. They only depend on the pixel
+// index and a density setting, so each layer builds them once, when first needed, and
+// keeps them until ledCount or that setting changes.
+
+// A Twinkle pixel that is lit at the current density. The 16-bit values are the raw
+// hashes the kernels used to compute for it every frame.
+struct TwinkleStar
+{
+    uint16_t index;
+    uint16_t phase;
+    uint16_t freq;
+    bool main; // mainColor rather than secondaryColor
+};
+
+class TwinkleTable
+{
+public:
+    TwinkleTable() : _numPixels(-1), _density(0) {}
+
+    // Only the pixels that are stars, in index order; everything else stays black.
+    const std::vector<TwinkleStar> &stars(int numPixels, float density);
+private:
+    std::vector<TwinkleStar> _stars;
+    int _numPixels;
+    float _density;
+};
+
+// Which pixels flash during a Sparkle time slot. A slot lasts several frames and a frame
+// looks at up to three slots, so the last few slots are kept. The returned list is only
+// valid until the next call.
+class SparkleTable
+{
+public:
+    SparkleTable() : _numPixels(-1), _density(0)
+    {
+        for(int i = 0; i < kSlots; i++) _slots[i] = INT32_MIN;
+    }
+
+    const std::vector<uint16_t> &flashes(int32_t timeSlot, int numPixels, float density);
+private:
+    static const int kSlots = 3;
+    std::vector<uint16_t> _flashes[kSlots];
+    int32_t _slots[kSlots];
+    int _numPixels;
+    float _density;
+};
+
+// GradientPulse's sharpened lerp amounts. powf(wave, exponent) only feeds an 8-bit lerp
+// amount, so instead of evaluating it per pixel, keep the level at which each of the 255
+// amounts starts and binary search it. Small exponents are very steep near zero, so the
+// levels are for curveRoot16() rather than curve16(): wave^exponent == root^(2*exponent).
+// Rebuilt only when the layer's exponent changes.
+class SharpnessTable
+{
+public:
+    SharpnessTable() : _exponent(NAN) {}
+
+    void prepare(float exponent);
+    // The lerp amount for a curveRoot16() level; prepare() first
+    inline uint8_t amount(uint16_t root) const
+    {
+        uint8_t amount = 0;
+        for(uint8_t step = 128; step > 0; step >>= 1)
+        {
+            if(root >= _thresholds[amount + step]) amount += step;
+        }
+        return amount;
+    }
+private:
+    std::vector<uint16_t> _thresholds;
+    float _exponent;
+};
+
+// Orders a frame's time slots by ascending flash level, so that drawing them in order
+// leaves each pixel at its brightest flash.
+template<typename Level>
+inline void sortSparkleSlots(int *timeSlots, Level *levels, int count)
+{
+    for(int i = 1; i < count; i++) {
+        for(int j = i; j > 0 && levels[j] < levels[j-1]; j--) {
+            std::swap(levels[j], levels[j-1]);
+            std::swap(timeSlots[j], timeSlots[j-1]);
+        }
+    }
+}
+
+#endif
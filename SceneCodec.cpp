@@ -0,0 +1,162 @@
+#include "SceneCodec.h"
+#include "Animations.h"
+
+namespace {
+
+class SceneWriter
+{
+public:
+    SceneWriter(uint8_t *out) : _out(out), _length(0) {}
+    void u8(uint8_t value) { _out[_length++] = value; }
+    void u16(uint16_t value) { u8(value & 0xFF); u8(value >> 8); }
+    void f32(float value) { memcpy(_out + _length, &value, 4); _length += 4; }
+    void color(const CRGB &value) { u8(value.r); u8(value.g); u8(value.b); }
+    int length() const { return _length; }
+private:
+    uint8_t *_out;
+    int _length;
+};
+
+class SceneReader
+{
+public:
+    SceneReader(const uint8_t *data, int length) : _data(data), _length(length), _position(0), _ok(true) {}
+    uint8_t u8()
+    {
+        if(_position >= _length) { _ok = false; return 0; }
+        return _data[_position++];
+    }
+    uint16_t u16() { uint16_t low = u8(); return low | (u8() << 8); }
+    float f32()
+    {
+        float value = 0;
+        if(_position + 4 > _length) { _ok = false; return 0; }
+        memcpy(&value, _data + _position, 4);
+        _position += 4;
+        return value;
+    }
+    CRGB color() { uint8_t r = u8(), g = u8(), b = u8(); return CRGB(r, g, b); }
+    // True if everything read was there, and nothing is left over
+    bool finished() const { return _ok && _position == _length; }
+    bool ok() const { return _ok; }
+private:
+    const uint8_t *_data;
+    int _length;
+    int _position;
+    bool _ok;
+};
+
+}
+
+int encodeScene(const ShinySettings &settings, uint8_t brightness, uint8_t *out)
+{
+    SceneWriter writer(out);
+    writer.u8(SCENE_VERSION);
+    writer.u8(SceneFlagFull);
+    writer.u8(SceneGlobalMode | SceneGlobalBrightness);
+    writer.u8(settings.mode);
+    writer.u8(brightness);
+
+    uint16_t layerMask = 0;
+    for(int i = 0; i < LAYER_COUNT; i++)
+    {
+        if(settings.layers[i].animationIndex != 0) layerMask |= 1 << i;
+    }
+    writer.u16(layerMask);
+
+    for(int i = 0; i < LAYER_COUNT; i++)
+    {
+        if(!(layerMask & (1 << i))) continue;
+        const ShinyLayerSettings &layer = settings.layers[i];
+        writer.u8(SceneFieldAll);
+        writer.f32(layer.speed);
+        writer.color(layer.mainColor);
+        writer.color(layer.secondaryColor);
+        writer.f32(layer.p_tau);
+        writer.f32(layer.p_phi);
+        writer.u8(layer.animationIndex);
+        writer.u8(layer.blendMode);
+        writer.u8(layer.segment);
+    }
+    return writer.length();
+}
+
+bool decodeScene(const uint8_t *data, int length, SceneUpdate *update)
+{
+    SceneReader reader(data, length);
+    if(reader.u8() != SCENE_VERSION) return false;
+
+    update->flags = reader.u8();
+    update->globalMask = reader.u8();
+    if(update->globalMask & SceneGlobalMode)
+    {
+        uint8_t mode = reader.u8();
+        if(mode >= RunModeCount) return false;
+        update->mode = (RunMode)mode;
+    }
+    if(update->globalMask & SceneGlobalBrightness) update->brightness = reader.u8();
+
+    update->layerMask = reader.u16();
+    if(update->layerMask >> LAYER_COUNT) return false;
+
+    for(int i = 0; i < LAYER_COUNT; i++)
+    {
+        update->fieldMasks[i] = 0;
+        if(!(update->layerMask & (1 << i))) continue;
+
+        uint8_t fields = reader.u8();
+        if(fields & ~SceneFieldAll) return false;
+        update->fieldMasks[i] = fields;
+
+        ShinyLayerSettings &layer = update->layers[i];
+        if(fields & SceneFieldSpeed) layer.speed = reader.f32();
+        if(fields & SceneFieldMainColor) layer.mainColor = reader.color();
+        if(fields & SceneFieldSecondaryColor) layer.secondaryColor = reader.color();
+        if(fields & SceneFieldTau) layer.p_tau = reader.f32();
+        if(fields & SceneFieldPhi) layer.p_phi = reader.f32();
+        if(fields & SceneFieldAnimation)
+        {
+            layer.animationIndex = reader.u8();
+            if(layer.animationIndex >= (int)animationNames.size()) return false;
+        }
+        if(fields & SceneFieldBlendMode)
+        {
+            uint8_t blendMode = reader.u8();
+            if(blendMode >= BlendModeCount) return false;
+            layer.blendMode = (LayerBlendMode)blendMode;
+        }
+        if(fields & SceneFieldSegment)
+        {
+            layer.segment = reader.u8();
+            if(layer.segment > SEGMENT_COUNT) return false;
+        }
+        if(!reader.ok()) return false;
+    }
+    return reader.finished();
+}
+
+void applySceneTo(const SceneUpdate &scene, ShinySettings &settings)
+{
+    if(scene.globalMask & SceneGlobalMode) settings.mode = scene.mode;
+
+    for(int i = 0; i < LAYER_COUNT; i++)
+    {
+        ShinyLayerSettings &layer = settings.layers[i];
+        if(!(scene.layerMask & (1 << i)))
+        {
+            if(scene.flags & SceneFlagFull) layer.animationIndex = 0;
+            continue;
+        }
+
+        uint8_t fields = scene.fieldMasks[i];
+        const ShinyLayerSettings &update = scene.layers[i];
+        if(fields & SceneFieldSpeed) layer.speed = update.speed;
+        if(fields & SceneFieldMainColor) layer.mainColor = update.mainColor;
+        if(fields & SceneFieldSecondaryColor) layer.secondaryColor = update.secondaryColor;
+        if(fields & SceneFieldTau) layer.p_tau = update.p_tau;
+        if(fields & SceneFieldPhi) layer.p_phi = update.p_phi;
+        if(fields & SceneFieldAnimation) layer.animationIndex = update.animationIndex;
+        if(fields & SceneFieldBlendMode) layer.blendMode = update.blendMode;
+        if(fields & SceneFieldSegment) layer.segment = update.segment;
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef __SCENE_CODEC__H
+#define __SCENE_CODEC__H
+#include "ShinyTypes.h"
+
+// Packed binary form of a whole scene (every layer's settings plus a few globals), so an
+// app can switch scenes with a single write instead of a write per property per layer.
+//
+// Little endian, version 1:
+//   u8  version
+//   u8  flags         SceneFlagFull: layers not in layerMask are turned off
+//   u8  globalMask    SceneGlobal* bits, then those globals in bit order:
+//       u8 mode, u8 brightness
+//   u16 layerMask     bit i set: layer i follows, in layer order, as
+//       u8 fieldMask  SceneField* bits, then those fields in bit order:
+//          f32 speed, u8[3] color1, u8[3] color2, f32 tau, f32 phi, u8 animation, u8 blendMode,
+//          u8 segment
+//
+// Writes can leave out anything that doesn't change, so a partial update is just the
+// fields that did.
+
+#define SCENE_VERSION 1
+// A full scene with every field of every layer
+#define SCENE_MAX_SIZE (7 + LAYER_COUNT * 22)
+
+enum SceneFlags : uint8_t
+{
+    SceneFlagFull = 1 << 0,
+};
+
+enum SceneGlobals : uint8_t
+{
+    SceneGlobalMode = 1 << 0,
+    SceneGlobalBrightness = 1 << 1,
+};
+
+enum SceneFields : uint8_t
+{
+    SceneFieldSpeed = 1 << 0,
+    SceneFieldMainColor = 1 << 1,
+    SceneFieldSecondaryColor = 1 << 2,
+    SceneFieldTau = 1 << 3,
+    SceneFieldPhi = 1 << 4,
+    SceneFieldAnimation = 1 << 5,
+    SceneFieldBlendMode = 1 << 6,
+    SceneFieldSegment = 1 << 7,
+
+    SceneFieldAll = 0xFF
+};
+
+// A decoded scene; only what's in the masks is meaningful.
+struct SceneUpdate
+{
+    uint8_t flags;
+    uint8_t globalMask;
+    RunMode mode;
+    uint8_t brightness;
+    uint16_t layerMask;
+    uint8_t fieldMasks[LAYER_COUNT];
+    ShinyLayerSettings layers[LAYER_COUNT];
+};
+
+// Encodes every layer that has an animation, as a full scene. Returns the length used.
+int encodeScene(const ShinySettings &settings, uint8_t brightness, uint8_t *out);
+
+// Returns false, leaving update in an unspecified state, if data isn't a valid scene.
+bool decodeScene(const uint8_t *data, int length, SceneUpdate *update);
+
+// Applies a decoded scene straight onto settings, for previews that shouldn't touch the
+// stored properties. Brightness isn't part of ShinySettings, so it's left out.
+void applySceneTo(const SceneUpdate &scene, ShinySettings &settings);
+
+#endif
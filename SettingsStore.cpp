@@ -0,0 +1,234 @@
+#include "SettingsStore.h"
+#include "Util.h"
+#include <nvs.h>
+#include <esp_timer.h>
+
+#define SETTINGS_BLOB_KEY "settings"
+#define SETTINGS_BLOB_VERSION 1
+// Where a blob that doesn't decode is moved aside to, for looking at later
+#define SETTINGS_BAD_BLOB_KEY "settingsBad"
+
+bool SettingsStore::begin(const char *name)
+{
+    _name = name;
+    if(!_prefs.begin(name)) return false;
+
+    size_t length = _prefs.getBytesLength(SETTINGS_BLOB_KEY);
+    if(length == 0)
+    {
+        // Nothing stored yet, or stored by firmware from before the blob
+        _legacy = true;
+        return true;
+    }
+
+    std::vector<uint8_t> blob(length);
+    if(_prefs.getBytes(SETTINGS_BLOB_KEY, blob.data(), length) != length)
+    {
+        logger.println("can't read stored settings; using defaults, and not saving changes");
+        _readOnly = true;
+        return true;
+    }
+    if(blob[0] > SETTINGS_BLOB_VERSION)
+    {
+        // Firmware was downgraded; keep the newer settings for when it's upgraded again
+        logger.printf("settings were stored by newer firmware (version %d); using defaults, and not saving changes\n", blob[0]);
+        _readOnly = true;
+        return true;
+    }
+    if(!decode(blob))
+    {
+        _values.clear();
+        if(_prefs.putBytes(SETTINGS_BAD_BLOB_KEY, blob.data(), length) != length)
+        {
+            logger.println("stored settings are corrupt and can't be set aside; using defaults, and not saving changes");
+            _readOnly = true;
+            return true;
+        }
+        logger.println("stored settings are corrupt; kept them as " SETTINGS_BAD_BLOB_KEY " and starting from defaults");
+        return true;
+    }
+    _stored = blob;
+    return true;
+}
+
+void SettingsStore::finishLoad()
+{
+    if(!_legacy) return;
+    logger.printf("migrating %d settings to a single blob\n", (int)_legacyKeys.size());
+    _dirty = true;
+    if(flush()) _legacy = false;
+}
+
+const String &SettingsStore::getString(const char *key, const String &defaultValue)
+{
+    auto found = _values.find(key);
+    if(found != _values.end()) return found->second;
+    if(_legacy && _prefs.isKey(key))
+    {
+        _legacyKeys.push_back(key);
+        return _values[key] = _prefs.getString(key, defaultValue);
+    }
+    return defaultValue;
+}
+
+void SettingsStore::putString(const char *key, const String &value)
+{
+    auto found = _values.find(key);
+    if(found == _values.end())
+    {
+        _values[key] = value;
+    }
+    else if(found->second == value)
+    {
+        _stats.changes++;
+        _stats.flashWritesSaved++;
+        return;
+    }
+    else
+    {
+        found->second = value;
+    }
+    changed();
+}
+
+void SettingsStore::remove(const char *key)
+{
+    auto found = _values.find(key);
+    if(found == _values.end())
+    {
+        _stats.changes++;
+        _stats.flashWritesSaved++;
+        return;
+    }
+    _values.erase(found);
+    changed();
+}
+
+void SettingsStore::changed()
+{
+    unsigned long now = millis();
+    if(!_dirty) _firstChange = now;
+    _lastChange = now;
+    _dirty = true;
+    _unwrittenChanges++;
+    _stats.changes++;
+}
+
+void SettingsStore::update(unsigned long nowMillis)
+{
+    if(!_dirty) return;
+    if(nowMillis - _lastChange < SETTINGS_QUIET_MS && nowMillis - _firstChange < SETTINGS_MAX_DELAY_MS) return;
+    if(!flush())
+    {
+        // try again after another full wait rather than on every loop
+        _firstChange = _lastChange = nowMillis;
+    }
+}
+
+bool SettingsStore::flush()
+{
+    if(!_dirty) return true;
+    if(_readOnly)
+    {
+        // Changes only last until reboot; what's in flash isn't ours to overwrite
+        _unwrittenChanges = 0;
+        _dirty = false;
+        return true;
+    }
+    int64_t started = esp_timer_get_time();
+
+    encode(_encoded);
+    if(_encoded == _stored && _legacyKeys.empty())
+    {
+        _stats.flashWritesSaved += _unwrittenChanges;
+        _unwrittenChanges = 0;
+        _dirty = false;
+        return true;
+    }
+
+    // Preferences commits after every single put or remove, so go to NVS directly to
+    // write the blob and drop any old keys with one commit.
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(_name.c_str(), NVS_READWRITE, &handle);
+    if(err != ESP_OK)
+    {
+        logger.printf("failed to open preferences for writing: %s\n", esp_err_to_name(err));
+        return false;
+    }
+    err = nvs_set_blob(handle, SETTINGS_BLOB_KEY, _encoded.data(), _encoded.size());
+    for(const String &key : _legacyKeys)
+    {
+        if(err != ESP_OK) break;
+        err = nvs_erase_key(handle, key.c_str());
+        if(err == ESP_ERR_NVS_NOT_FOUND) err = ESP_OK;
+    }
+    if(err == ESP_OK) err = nvs_commit(handle);
+    nvs_close(handle);
+
+    if(err != ESP_OK)
+    {
+        logger.printf("failed to store preferences: %s\n", esp_err_to_name(err));
+        return false;
+    }
+
+    _stored = _encoded;
+    _legacyKeys.clear();
+    _stats.flashWrites++;
+    if(_unwrittenChanges > 1) _stats.flashWritesSaved += _unwrittenChanges - 1;
+    _unwrittenChanges = 0;
+    _dirty = false;
+    _stats.flushes++;
+    _stats.maxFlushMicros = max(_stats.maxFlushMicros, (uint32_t)(esp_timer_get_time() - started));
+    return true;
+}
+
+SettingsWriteStats SettingsStore::takeStats()
+{
+    SettingsWriteStats stats = _stats;
+    _stats = SettingsWriteStats();
+    return stats;
+}
+
+void SettingsStore::encode(std::vector<uint8_t> &blob) const
+{
+    blob.clear();
+    blob.push_back(SETTINGS_BLOB_VERSION);
+    blob.push_back(_values.size() & 0xFF);
+    blob.push_back(_values.size() >> 8);
+    for(const auto &entry : _values)
+    {
+        // keys are short and values are limited to a characteristic's 36 bytes
+        for(const String *string : {&entry.first, &entry.second})
+        {
+            size_t length = string->length() > 255 ? 255 : string->length();
+            blob.push_back(length);
+            blob.insert(blob.end(), string->c_str(), string->c_str() + length);
+        }
+    }
+}
+
+bool SettingsStore::decode(const std::vector<uint8_t> &blob)
+{
+    size_t position = 3;
+    if(blob.size() < position || blob[0] != SETTINGS_BLOB_VERSION) return false;
+    int count = blob[1] | (blob[2] << 8);
+
+    _values.clear();
+    for(int i = 0; i < count; i++)
+    {
+        String strings[2];
+        for(String &string : strings)
+        {
+            if(position >= blob.size()) return false;
+            size_t length = blob[position++];
+            if(position + length > blob.size()) return false;
+            char buffer[256];
+            memcpy(buffer, blob.data() + position, length);
+            buffer[length] = 0;
+            string = buffer;
+            position += length;
+        }
+        _values[strings[0]] = strings[1];
+    }
+    return position == blob.size();
+}
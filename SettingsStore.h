@@ -0,0 +1,100 @@
+#ifndef __SETTINGS_STORE__H
+#define __SETTINGS_STORE__H
+#include <Arduino.h>
+#include <Preferences.h>
+#include <map>
+#include <vector>
+#include <string.h>
+
+// Wait for this long without changes before writing them to flash...
+#define SETTINGS_QUIET_MS 1500
+// ...but never keep changes unwritten for longer than this, even if they keep coming.
+#define SETTINGS_MAX_DELAY_MS 10000
+
+// What the store did since the last takeStats()
+struct SettingsWriteStats
+{
+    uint32_t changes; // putString()s and remove()s
+    uint32_t flashWrites; // blobs actually written
+    uint32_t flashWritesSaved; // changes that were coalesced or turned out to be no-ops
+    uint32_t flushes;
+    uint32_t maxFlushMicros;
+};
+
+// Every stored setting, kept in RAM and written to flash as a single blob.
+//
+// At boot, the whole blob is read and decoded in one go, rather than one NVS lookup per
+// setting per layer. Settings still at their default aren't stored at all.
+//
+// Writing to flash takes milliseconds and wears the flash, and dragging a slider in the
+// app sets the same property dozens of times a second. So changes only go to RAM at
+// first (and reads see them right away); once they stop coming for a while, the blob is
+// rewritten with all of them in one NVS transaction, unless it ended up the same as
+// what's already stored. A power cut can lose at most the last SETTINGS_MAX_DELAY_MS of
+// changes.
+//
+// Blob format, version 1: u8 version, u16 count, then count times
+//   u8 key length, key, u8 value length, value
+//
+// Older firmware stored each setting under its own key. If there's no blob, those are
+// read instead, and finishLoad() replaces them with a blob. A blob that can't be read, or
+// that newer firmware wrote, is left alone: settings start at their defaults, and changes
+// aren't saved. One that's corrupt is copied aside before it gets replaced.
+class SettingsStore
+{
+public:
+    SettingsStore(Preferences &prefs) : _prefs(prefs), _legacy(false), _readOnly(false), _dirty(false), _unwrittenChanges(0), _firstChange(0), _lastChange(0), _stats() {}
+
+    // Opens the namespace and reads the blob; false if NVS isn't usable.
+    bool begin(const char *name);
+    // Call when every setting has been read once at boot.
+    void finishLoad();
+
+    // None of these allocate, unless a setting goes from its default to something else
+    const String &getString(const char *key, const String &defaultValue);
+    void putString(const char *key, const String &value);
+    void remove(const char *key);
+
+    // Call regularly; writes out pending changes once they've settled.
+    void update(unsigned long nowMillis);
+    // Writes out pending changes now. Returns false (and keeps them pending) on failure.
+    bool flush();
+    bool hasPending() const { return _dirty; }
+
+    SettingsWriteStats takeStats();
+private:
+    void changed();
+    bool decode(const std::vector<uint8_t> &blob);
+    // Into out, reusing its capacity
+    void encode(std::vector<uint8_t> &out) const;
+
+    // Lets _values be searched with a plain char* key, without making a String of it
+    struct KeyLess
+    {
+        typedef void is_transparent;
+        bool operator()(const String &a, const String &b) const { return strcmp(a.c_str(), b.c_str()) < 0; }
+        bool operator()(const String &a, const char *b) const { return strcmp(a.c_str(), b) < 0; }
+        bool operator()(const char *a, const String &b) const { return strcmp(a, b.c_str()) < 0; }
+    };
+
+    Preferences &_prefs;
+    String _name;
+    std::map<String, String, KeyLess> _values;
+    // What's in flash, so rewriting it unchanged can be skipped
+    std::vector<uint8_t> _stored;
+    std::vector<uint8_t> _encoded;
+
+    // Settings still under their own keys, to be removed once the blob is written
+    bool _legacy;
+    std::vector<String> _legacyKeys;
+    // Flash holds settings we can't use but mustn't lose
+    bool _readOnly;
+
+    bool _dirty;
+    uint32_t _unwrittenChanges;
+    unsigned long _firstChange;
+    unsigned long _lastChange;
+    SettingsWriteStats _stats;
+};
+
+#endif
@@ -22,3 +22,58 @@ std::vector<String> ledColorOrderNames = {
     "GRB",
     "BGR",
 };
+
+std::vector<String> ledLayoutNames = {
+    "Duplicate",
+    "Split",
+    "Split From Center",
+    "Split Folded",
+    "Mapped",
+};
+
+std::vector<String> clockSourceNames = {
+    "Wall",
+    "Beat",
+    "Mesh",
+};
+
+void ledOutputsFromString(const char *str, LedOutputMap outputs[LED_OUTPUT_COUNT])
+{
+    for(int i = 0; i < LED_OUTPUT_COUNT; i++)
+    {
+        LedOutputMap output;
+        char *end;
+        long start = strtol(str, &end, 10);
+        long count = strtol(end, &end, 10);
+        output.start = constrain(start, 0, MAX_LED_COUNT);
+        output.count = constrain(count, 0, MAX_LED_COUNT);
+        output.reversed = strtol(end, &end, 10) != 0;
+        while(*end == ' ') end++;
+        for(int order = 0; order < LedOrderCount; order++)
+        {
+            const String &name = ledColorOrderNames[order];
+            if(strncmp(end, name.c_str(), name.length()) == 0) output.colorOrder = (LedColorOrder)order;
+        }
+        outputs[i] = output;
+
+        str = strchr(end, ';');
+        if(!str) str = ""; else str++;
+    }
+}
+
+void ledSegmentsFromString(const char *str, LedSegment segments[SEGMENT_COUNT])
+{
+    for(int i = 0; i < SEGMENT_COUNT; i++)
+    {
+        LedSegment segment;
+        char *end;
+        long start = strtol(str, &end, 10);
+        long count = strtol(end, &end, 10);
+        segment.start = constrain(start, 0, MAX_LED_COUNT);
+        segment.count = constrain(count, 0, MAX_LED_COUNT);
+        segments[i] = segment;
+
+        str = strchr(end, ';');
+        if(!str) str = ""; else str++;
+    }
+}
@@ -15,6 +15,12 @@ void setMode(RunMode newMode);
 #define LAYER_COUNT 10
 #define MAX_LED_COUNT 800
 
+// Default for ShinyLayerSettings::fixedPoint: render layers with the integer kernels in
+// FixedAnimations.cpp instead of the float ones in Animations.cpp.
+#ifndef SHINY_FIXED_POINT_ANIMATIONS
+#define SHINY_FIXED_POINT_ANIMATIONS 1
+#endif
+
 enum LayerBlendMode
 {
     BlendModeAdd,
@@ -46,6 +52,56 @@ enum LedColorOrder
 };
 extern std::vector<String> ledColorOrderNames;
 
+// How the logical strip is spread over the two GROVE outputs
+enum LedLayout
+{
+    LedLayoutDuplicate, // both pins carry the whole strip
+    LedLayoutSplit, // GROVE1 drives the first half, GROVE2 the second
+    LedLayoutSplitFromCenter, // like Split, with the first half reversed: both strips start at a controller in the middle
+    LedLayoutSplitFolded, // like Split, with the second half reversed: both strips start at the same end
+    LedLayoutMapped, // each output shows its own part of the strip; see ShinySettings::outputs
+
+    LedLayoutCount
+};
+extern std::vector<String> ledLayoutNames;
+
+// Where one GROVE output's pixels come from in the logical strip, for LedLayoutMapped.
+// Outputs may overlap, e.g. to show the same pixels on both sleeves of a jacket.
+#define LED_OUTPUT_COUNT 2
+struct LedOutputMap
+{
+    uint16_t start = 0;
+    uint16_t count = 0;
+    bool reversed = false; // the output's first LED shows the last of its pixels
+    LedColorOrder colorOrder = LedOrderGRB;
+};
+// Parses "start count reversed order;..." (e.g. "0 120 0 GRB;120 80 1 RGB"), one entry
+// per output; outputs without an entry get no pixels.
+void ledOutputsFromString(const char *str, LedOutputMap outputs[LED_OUTPUT_COUNT]);
+
+// A run of the logical strip that layers can be confined to, so they only spend render
+// time on the pixels they actually light up. A layer's animation runs over its segment
+// as if it were the whole strip.
+#define SEGMENT_COUNT 4
+struct LedSegment
+{
+    uint16_t start = 0;
+    uint16_t count = 0;
+};
+// Parses "start count;..." (e.g. "0 120;120 80"); segments without an entry are empty.
+void ledSegmentsFromString(const char *str, LedSegment segments[SEGMENT_COUNT]);
+
+// What all layers' animation time follows; see AnimationClock.h
+enum ClockSource
+{
+    ClockSourceWall, // seconds since boot
+    ClockSourceBeat, // beats of the music the mic hears
+    ClockSourceMesh, // seconds, shared with other cores
+
+    ClockSourceCount
+};
+extern std::vector<String> clockSourceNames;
+
 struct ShinyLayerSettings
 {
     CRGB mainColor = CRGB(255, 100, 0);
@@ -55,10 +111,30 @@ struct ShinyLayerSettings
     float p_tau = 10.0;
     float p_phi = 4.0;
     int animationIndex = 0;
+    bool fixedPoint = SHINY_FIXED_POINT_ANIMATIONS;
+    int segment = 0; // 0 for the whole strip, or 1 to SEGMENT_COUNT
+
+    // Field by field, since the padding between them isn't guaranteed to survive a copy
+    bool operator==(const ShinyLayerSettings &other) const
+    {
+        return mainColor == other.mainColor && secondaryColor == other.secondaryColor &&
+            blendMode == other.blendMode && speed == other.speed && p_tau == other.p_tau &&
+            p_phi == other.p_phi && animationIndex == other.animationIndex &&
+            fixedPoint == other.fixedPoint && segment == other.segment;
+    }
+    bool operator!=(const ShinyLayerSettings &other) const { return !(*this == other); }
 };
 
 void setLayer(int newLayer);
 
+// Primary colors of the other shinercores we're connected to
+#define MAX_NEIGHBOURS 8
+struct NeighbourColors
+{
+    int count = 0;
+    CRGB colors[MAX_NEIGHBOURS];
+};
+
 struct ShinySettings
 {
     RunMode mode;
@@ -66,6 +142,23 @@ struct ShinySettings
     int currentLayerIndex = 1;
     LedColorOrder ledColorOrder = LedOrderGRB;
     int ledCount = MAX_LED_COUNT/2;
+    LedLayout ledLayout = LedLayoutDuplicate;
+    LedOutputMap outputs[LED_OUTPUT_COUNT];
+    LedSegment segments[SEGMENT_COUNT];
+    ClockSource clockSource = ClockSourceWall;
+    NeighbourColors neighbours;
+    // Bumped when something the layers don't track changes how the whole strip looks
+    // (its length, color order or layout, neighbours' colors), so the render task redraws
+    // every layer
+    uint32_t redraws = 0;
+    // Bumped on every preset recall, so the render task crossfades to what follows
+    uint32_t presetRecalls = 0;
+    float presetFade = 1.0; // seconds
+    // Applied on the way out to the strips, by OutputStage
+    uint8_t brightness = 255;
+    CRGB whiteBalance = CRGB(255, 255, 255); // per-channel scale, 255 is unchanged
+    float outputGamma = 1.0; // 1 sends levels as they are; ~2.2 makes them perceptually even
+    bool dither = true;
     ShinyLayerSettings *currentLayer()
     {
         return &layers[currentLayerIndex];
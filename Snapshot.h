@@ -0,0 +1,45 @@
+#ifndef __SNAPSHOT__H
+#define __SNAPSHOT__H
+#include <atomic>
+#include <stdint.h>
+
+// Hands the latest copy of a value from one writer task to one reader task, without either
+// side ever waiting on the other.
+//
+// There are three slots: the writer's, the reader's, and a "middle" one that is exchanged
+// atomically. publish() fills the writer's slot and swaps it into the middle; read() swaps
+// the middle out if something new was published since. The reader's slot is never touched
+// by the writer, so the value read() returns stays intact until the next read().
+template<typename T>
+class Snapshot
+{
+public:
+    Snapshot() : _middle(1), _writeSlot(0), _readSlot(2) {}
+
+    // Writer side
+    void publish(const T &value)
+    {
+        _slots[_writeSlot] = value;
+        _writeSlot = _middle.exchange(_writeSlot | kFresh) & kSlotMask;
+    }
+
+    // Reader side
+    T &read()
+    {
+        if(_middle.load() & kFresh)
+        {
+            _readSlot = _middle.exchange(_readSlot) & kSlotMask;
+        }
+        return _slots[_readSlot];
+    }
+private:
+    static const uint32_t kSlotMask = 0x3;
+    static const uint32_t kFresh = 0x4;
+
+    T _slots[3];
+    std::atomic<uint32_t> _middle;
+    uint32_t _writeSlot;
+    uint32_t _readSlot;
+};
+
+#endif
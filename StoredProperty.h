@@ -8,6 +8,11 @@
 #define kDescriptorPresentationFormat_String "19"
 #define kDescriptorValidRange "2906"
 
+// Property values are at most this long, so that they fit in a characteristic
+#define kMaxValueLength 36
+// NVS keys are at most 15 characters
+#define kMaxKeyLength 16
+
 // Stores a setting under a specific string key name, and also publishes that setting over bluetooth with a characteristic UUID. Calls an 
 // "applicator" whenever the value is changed either by reading from disk or from changing by bluetooth command; implement this function to 
 // apply this setting in business logic.
@@ -15,7 +20,7 @@ class StoredProperty
 {
 public:
     StoredProperty(const char *uuid, const char *key, String defaultValue, const char *range, std::function<void(const String&)> applicator)
-      : chara(uuid, BLERead | BLEWrite, 36),
+      : chara(uuid, BLERead | BLEWrite | BLENotify, kMaxValueLength),
         key(key),
         value(defaultValue),
         defaultValue(defaultValue),
@@ -27,14 +32,20 @@ public:
         chara.addDescriptor(nameDescriptor);
         chara.addDescriptor(formatDescriptor);
     }
-    void set(const String &newVal)
+    // value keeps its buffer across sets, so setting a value doesn't allocate unless it's
+    // longer than any before it
+    void set(const char *newVal)
     {
         value = newVal;
         save();
         chara.writeValue(value);
         applicator(value);
     }
-    String get()
+    void set(const String &newVal)
+    {
+        set(newVal.c_str());
+    }
+    const String &get()
     {
         return value;
     }
@@ -52,45 +63,54 @@ public:
     {
         if(chara.written())
         {
-            String oldValue = value;
-            String newValue = chara.value();
+            // the raw bytes, rather than chara.value(), which would make a String of them
+            const BLECharacteristic &raw = chara;
+            char newValue[kMaxValueLength + 1];
+            int length = std::min(raw.valueLength(), kMaxValueLength);
+            memcpy(newValue, raw.value(), length);
+            newValue[length] = 0;
             set(newValue);
         }
     }
     virtual void load()
     {
-        String curKey = currentKey();
-        value = prefs.getString(curKey.c_str(), defaultValue);
+        loadValue();
         chara.writeValue(value);
-        applicator(value);
-        logger.print(curKey); logger.print(" := "); logger.println(value);
     }
     void writeToChara()
     {
-        String curKey = currentKey();
-        value = prefs.getString(curKey.c_str(), defaultValue);
+        value = settingsStore.getString(currentKey(), defaultValue);
         chara.writeValue(value);
     }
 protected:
+    // Reads and applies the stored value, without showing it over bluetooth
+    void loadValue()
+    {
+        const char *curKey = currentKey();
+        value = settingsStore.getString(curKey, defaultValue);
+        applicator(value);
+        if(!value.equals(defaultValue))
+        {
+            logger.print(curKey); logger.print(" := "); logger.println(value);
+        }
+    }
     void save()
     {
-        String curKey = currentKey();
+        const char *curKey = currentKey();
         if(value.isEmpty() || value.equals(" ") || value.equals(defaultValue))
         {
-            prefs.remove(curKey.c_str());
+            settingsStore.remove(curKey);
             value = defaultValue;
         }
-        else if(prefs.putString(curKey.c_str(), value) == 0)
+        else
         {
-            logger.println("failed to store preferences!");
-            while (1);
+            settingsStore.putString(curKey, value);
         }
-        logger.print(curKey); logger.print(" = "); logger.println(value);
     }
 protected:
-    virtual String currentKey()
+    virtual const char *currentKey()
     {
-        return key;
+        return key.c_str();
     }
     BLEStringCharacteristic chara;
     String key;
@@ -109,30 +129,56 @@ class StoredMultiProperty : public StoredProperty
 public:
     StoredMultiProperty(const char *uuid, const char *key, String defaultValue, const char *range, std::function<void(const String&)> applicator) :
         StoredProperty(uuid, key, defaultValue, range, applicator)
-    {}
+    {
+        for(int i = 0; i < LAYER_COUNT; i++)
+        {
+            snprintf(layerKeys[i], kMaxKeyLength, "%s-%d", key, i);
+        }
+    }
 
     virtual void load()
     {
-        logger.print("Loading every layer's value for key "); logger.println(key);
         int savedLayer = StoredMultiProperty::getLayer();
         // at app launch, load EVERY layer's value
         for(int i = 0; i < LAYER_COUNT; i++)
         {
             StoredMultiProperty::useLayer(i);
-            this->StoredProperty::load();
+            loadValue();
         }
-        // and then get the current one's
+        // and then show the current one's; it's been applied already
         StoredMultiProperty::useLayer(savedLayer);
-        this->StoredProperty::load();
+        writeToChara();
+    }
+
+    // Sets the value for any layer, not just the current one. Only the current layer's
+    // value is shown over bluetooth.
+    void setForLayer(int layer, const char *newVal)
+    {
+        int selected = getLayer();
+        useLayer(layer);
+        value = newVal;
+        save();
+        applicator(value);
+        useLayer(selected);
+        if(layer == selected)
+        {
+            chara.writeValue(value);
+        }
+        else
+        {
+            value = settingsStore.getString(currentKey(), defaultValue);
+        }
     }
 
     static int getLayer() { return currentLayer; }
     static void useLayer(int newLayer) { currentLayer = newLayer; }
 protected:
     static int currentLayer;
-    virtual String currentKey()
+    // "key-layer", made up front rather than on every use
+    char layerKeys[LAYER_COUNT][kMaxKeyLength];
+    virtual const char *currentKey()
     {
-        return key + "-" + String(currentLayer);
+        return layerKeys[currentLayer];
     }
 
     // TODO:
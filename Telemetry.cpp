@@ -0,0 +1,132 @@
+#include "Telemetry.h"
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+
+Telemetry telemetry;
+
+const char *telemetryStageNames[StageCount] = {
+    "loop", "M5.update", "comms", "frame",
+    "layer 0", "layer 1", "layer 2", "layer 3", "layer 4",
+    "layer 5", "layer 6", "layer 7", "layer 8", "layer 9",
+    "blend", "color order", "show",
+};
+static_assert(LAYER_COUNT == 10, "telemetryStageNames has a name for each layer");
+
+static inline int bucketFor(uint32_t micros)
+{
+    if(micros < 2) return micros;
+    int msb = 31 - __builtin_clz(micros);
+    return min(2 * msb + (int)((micros >> (msb - 1)) & 1), 31);
+}
+
+// The smallest time that lands in bucket
+static inline uint32_t bucketStart(int bucket)
+{
+    if(bucket < 2) return bucket;
+    int msb = bucket / 2;
+    return (1u << msb) | ((bucket & 1u) << (msb - 1));
+}
+
+int64_t Telemetry::recordSince(TelemetryStage stage, int64_t started)
+{
+    int64_t now = esp_timer_get_time();
+    record(stage, now - started);
+    return now;
+}
+
+void Telemetry::record(TelemetryStage stage, uint32_t micros)
+{
+    Histogram &histogram = _stages[stage];
+    histogram.buckets[bucketFor(micros)].fetch_add(1, std::memory_order_relaxed);
+    if(micros > histogram.max.load(std::memory_order_relaxed))
+    {
+        histogram.max.store(micros, std::memory_order_relaxed);
+    }
+}
+
+TelemetryReport Telemetry::take()
+{
+    TelemetryReport report;
+    int64_t now = esp_timer_get_time();
+    float seconds = (now - _windowStarted) / 1000000.0f;
+    report.windowMillis = (now - _windowStarted) / 1000;
+    report.renderedFps = _renderedFrames.exchange(0) / seconds;
+    report.sentFps = _sentFrames.exchange(0) / seconds;
+    report.freeHeap = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    _windowStarted = now;
+
+    for(int stage = 0; stage < StageCount; stage++)
+    {
+        Histogram &histogram = _stages[stage];
+        StageSummary &summary = report.stages[stage];
+        uint32_t counts[kBuckets];
+        summary.count = 0;
+        for(int i = 0; i < kBuckets; i++)
+        {
+            counts[i] = histogram.buckets[i].exchange(0, std::memory_order_relaxed);
+            summary.count += counts[i];
+        }
+        summary.max = histogram.max.exchange(0, std::memory_order_relaxed);
+
+        uint32_t *percentiles[] = { &summary.p50, &summary.p99 };
+        uint32_t ranks[] = { summary.count / 2, summary.count - summary.count / 100 - 1 };
+        for(int p = 0; p < 2; p++)
+        {
+            *percentiles[p] = 0;
+            if(summary.count == 0) continue;
+            uint32_t seen = 0;
+            for(int i = 0; i < kBuckets; i++)
+            {
+                seen += counts[i];
+                if(seen > ranks[p])
+                {
+                    uint32_t top = i + 1 < kBuckets ? bucketStart(i + 1) - 1 : summary.max;
+                    *percentiles[p] = min(top, summary.max);
+                    break;
+                }
+            }
+        }
+    }
+    return report;
+}
+
+static inline uint16_t saturate16(uint32_t value)
+{
+    return value > 0xFFFF ? 0xFFFF : value;
+}
+
+int encodeTelemetry(const TelemetryReport &report, uint8_t *out)
+{
+    int length = 0;
+    auto u8 = [&](uint8_t value) { out[length++] = value; };
+    auto u16 = [&](uint16_t value) { u8(value & 0xFF); u8(value >> 8); };
+    auto u32 = [&](uint32_t value) { u16(value & 0xFFFF); u16(value >> 16); };
+
+    u8(TELEMETRY_VERSION);
+    u8(StageCount);
+    u32(report.windowMillis);
+    u16(saturate16(report.renderedFps * 10));
+    u16(saturate16(report.sentFps * 10));
+    u32(report.freeHeap);
+    for(const StageSummary &stage : report.stages)
+    {
+        u16(saturate16(stage.p50));
+        u16(saturate16(stage.p99));
+        u16(saturate16(stage.max));
+        u16(saturate16(stage.count));
+    }
+    return length;
+}
+
+void printTelemetry(Print &out, const TelemetryReport &report)
+{
+    out.printf("Telemetry over %.1f s: %.1f fps rendered, %.1f fps sent, %u bytes heap free\n",
+        report.windowMillis / 1000.0f, report.renderedFps, report.sentFps, report.freeHeap);
+    out.printf("  %-12s %8s %8s %8s %8s\n", "stage", "p50 us", "p99 us", "max us", "count");
+    for(int stage = 0; stage < StageCount; stage++)
+    {
+        const StageSummary &summary = report.stages[stage];
+        if(summary.count == 0) continue;
+        out.printf("  %-12s %8u %8u %8u %8u\n", telemetryStageNames[stage], summary.p50, summary.p99, summary.max, summary.count);
+    }
+}
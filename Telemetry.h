@@ -0,0 +1,85 @@
+#ifndef __TELEMETRY__H
+#define __TELEMETRY__H
+#include <Arduino.h>
+#include <atomic>
+#include "ShinyTypes.h"
+
+// The parts of the loop, render and LED output tasks that get timed
+enum TelemetryStage
+{
+    StageLoop, // a whole loop() iteration
+    StageM5Update,
+    StageComms, // commsUpdate(): BLE polling and remote cores
+    StageFrame, // a whole renderFrame()
+    StageLayer0, // rendering each layer, blend included
+    StageBlend = StageLayer0 + LAYER_COUNT, // blending layers onto the strip
+    StageColorOrder, // OutputStage::write(): levels, color order and layout
+    StageShow, // FastLED.show() in the LED output task
+
+    StageCount
+};
+extern const char *telemetryStageNames[StageCount];
+
+// One stage's timings over a report window, in microseconds. Percentiles are the top of
+// the histogram bucket they fall in, so they're up to a third too high.
+struct StageSummary
+{
+    uint32_t p50;
+    uint32_t p99;
+    uint32_t max;
+    uint32_t count;
+};
+
+struct TelemetryReport
+{
+    uint32_t windowMillis;
+    float renderedFps; // renderFrame() calls
+    float sentFps; // frames that changed and went to the strip
+    uint32_t freeHeap;
+    StageSummary stages[StageCount];
+};
+
+// Binary form of a TelemetryReport, little endian:
+//   u8 version, u8 stage count, u32 window ms, u16 rendered fps x10, u16 sent fps x10,
+//   u32 free heap, then per stage in TelemetryStage order:
+//   u16 p50 us, u16 p99 us, u16 max us, u16 count (all saturating)
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_MAX_SIZE (14 + StageCount * 8)
+int encodeTelemetry(const TelemetryReport &report, uint8_t *out);
+
+// Timing histograms for each stage. Recording is a couple of atomic adds, so it's cheap
+// enough to do every frame. Each stage must only be recorded from one task; take() can be
+// called from any.
+class Telemetry
+{
+public:
+    Telemetry() : _windowStarted(0), _renderedFrames(0), _sentFrames(0) {}
+
+    // Records that stage took since started (from esp_timer_get_time()), and returns now,
+    // so consecutive stages can be chained.
+    int64_t recordSince(TelemetryStage stage, int64_t started);
+    void record(TelemetryStage stage, uint32_t micros);
+
+    void frameRendered() { _renderedFrames++; }
+    void frameSent() { _sentFrames++; }
+
+    // Summarizes everything since the last call, and starts over.
+    TelemetryReport take();
+private:
+    // Half-octave buckets: 0, 1, 2, 3, 4-5, 6-7, 8-11, 12-15, ... up to 49152 and over
+    static const int kBuckets = 32;
+    struct Histogram
+    {
+        std::atomic<uint32_t> buckets[kBuckets];
+        std::atomic<uint32_t> max;
+    };
+    Histogram _stages[StageCount];
+    int64_t _windowStarted;
+    std::atomic<uint32_t> _renderedFrames;
+    std::atomic<uint32_t> _sentFrames;
+};
+extern Telemetry telemetry;
+
+void printTelemetry(Print &out, const TelemetryReport &report);
+
+#endif
@@ -1,3 +1,25 @@
 #include "Util.h"
+#include <algorithm>
 
-Logger logger = Logger();
\ No newline at end of file
+Logger logger = Logger();
+
+int NameIndex::find(const char *name)
+{
+    if(_entries.size() != _names.size())
+    {
+        _entries.clear();
+        for(size_t i = 0; i < _names.size(); i++)
+        {
+            _entries.push_back((uint64_t)nameHash(_names[i].c_str()) << 32 | i);
+        }
+        std::sort(_entries.begin(), _entries.end());
+    }
+
+    uint64_t hash = nameHash(name);
+    for(auto it = std::lower_bound(_entries.begin(), _entries.end(), hash << 32); it != _entries.end() && (*it >> 32) == hash; ++it)
+    {
+        int index = *it & 0xFFFFFFFF;
+        if(strcmp(_names[index].c_str(), name) == 0) return index;
+    }
+    return -1;
+}
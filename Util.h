@@ -2,6 +2,7 @@
 #define UTIL__H
 #include "M5Unified.h"
 #include "FastLED.h"
+#include <vector>
 
 class Logger : public Print
 {
@@ -31,15 +32,59 @@ inline float curve(float progress)
     return sin((progress-0.25)*6.28f)/2.0f + 0.5f;
 }
 
+// Simple hash for deterministic pseudo-random based on position/time
+// Allows "random" effects to be stateless
+inline uint32_t hash(uint32_t x) {
+    x = ((x >> 16) ^ x) * 0x45d9f3b;
+    x = ((x >> 16) ^ x) * 0x45d9f3b;
+    x = (x >> 16) ^ x;
+    return x;
+}
+
+// Returns pseudo-random float 0-1 for a given seed
+inline float hashFloat(uint32_t seed) {
+    return (hash(seed) & 0xFFFF) / 65535.0f;
+}
+
+// Parses "r g b" in place, without making substrings of it
+inline CRGB rgbFromString(const char *str)
+{
+    char *end;
+    long r = strtol(str, &end, 10);
+    long g = strtol(end, &end, 10);
+    long b = strtol(end, &end, 10);
+    return CRGB(r, g, b);
+}
+
 inline CRGB rgbFromString(const String &str)
 {
-    int firstSpace = str.indexOf(' ');
-    int secondSpace = str.lastIndexOf(' ');
-    return CRGB(
-        str.substring(0, firstSpace).toInt(), 
-        str.substring(firstSpace+1, secondSpace).toInt(),
-        str.substring(secondSpace+1, str.length()).toInt()
-    );
+    return rgbFromString(str.c_str());
 }
 
+// A macro's value as a string literal, e.g. SEGMENT_COUNT in a property's range
+#define STRINGIFY_VALUE(x) #x
+#define STRINGIFY(x) STRINGIFY_VALUE(x)
+
+// FNV-1a; constexpr, so names can be hashed at compile time too
+constexpr uint32_t nameHash(const char *name, uint32_t hash = 2166136261u)
+{
+    return *name ? nameHash(name + 1, (hash ^ (uint8_t)*name) * 16777619u) : hash;
+}
+
+// Finds a name's index in a list of names by hash, instead of comparing it to each name
+// in turn. The hashes are worked out on first use, so names can be a global from another
+// file.
+class NameIndex
+{
+public:
+    NameIndex(const std::vector<String> &names) : _names(names) {}
+    // The index of name in names, or -1 if it isn't there
+    int find(const char *name);
+    int find(const String &name) { return find(name.c_str()); }
+private:
+    const std::vector<String> &_names;
+    // hash << 32 | index, sorted
+    std::vector<uint64_t> _entries;
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,219 @@
+// Plays WAV files through the beat detector as if they came from the microphone, and
+// checks that it finds their tempo.
+//
+//   BeatDetectorTest [file_128bpm.wav ...]
+//
+// A file's expected tempo is the number before "bpm" at the end of its name. Without
+// files, it plays synthetic drum loops at a range of tempos instead, encoded as WAV and
+// read back so they take the same path a recording would.
+#include <driver/i2s.h>
+#include "Util.h"
+#include "BeatDetector.h"
+#include <vector>
+#include <memory>
+#include <string>
+
+static const int kSampleRate = 16000;
+// Where the tempo is read off; the detector needs ~6 s of history before its first guess
+static const float kListenSeconds = 20;
+// How close the detected tempo has to be. Half or double the tempo is reported as such,
+// but it's a failure.
+static const float kTolerance = 0.02f;
+
+struct DrumLoop
+{
+    float bpm;
+    // Why the detector is known to hear this one at half or double time, or NULL. Those
+    // are reported, but don't fail the test; hearing it right is reported too, so the
+    // entry can go.
+    const char *knownOctaveError;
+};
+
+static const DrumLoop kDrumLoops[] = {
+    { 90, NULL },
+    { 105, NULL },
+    { 128, NULL },
+    { 140, NULL },
+    // The autocorrelation is weighted towards 120 bpm, which tips this over to 87. Its
+    // integer lags can't tell it from 87 bpm with offbeat hi-hats either: 174's period
+    // isn't a whole number of hops, so the true beat lines up worse than the offbeats do.
+    { 174, "weighted towards 120 bpm, and lags are whole hops" },
+};
+
+enum TempoResult
+{
+    TempoExact,
+    TempoOctave, // half or double time
+    TempoWrong,
+};
+
+static void put16(std::vector<uint8_t> &out, uint16_t value) { out.push_back(value); out.push_back(value >> 8); }
+static void put32(std::vector<uint8_t> &out, uint32_t value) { put16(out, value); put16(out, value >> 16); }
+static uint16_t get16(const uint8_t *in) { return in[0] | (in[1] << 8); }
+static uint32_t get32(const uint8_t *in) { return get16(in) | (get16(in + 2) << 16); }
+
+static std::vector<uint8_t> encodeWav(const std::vector<int16_t> &samples, int rate)
+{
+    std::vector<uint8_t> wav;
+    wav.insert(wav.end(), { 'R', 'I', 'F', 'F' });
+    put32(wav, 36 + samples.size() * 2);
+    wav.insert(wav.end(), { 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ' });
+    put32(wav, 16);
+    put16(wav, 1); // PCM
+    put16(wav, 1); // mono
+    put32(wav, rate);
+    put32(wav, rate * 2);
+    put16(wav, 2);
+    put16(wav, 16);
+    wav.insert(wav.end(), { 'd', 'a', 't', 'a' });
+    put32(wav, samples.size() * 2);
+    for(int16_t sample : samples) put16(wav, sample);
+    return wav;
+}
+
+// 16 bit PCM, any channel count and rate; mixed down to mono at the mic's 16 kHz. Empty
+// if it isn't a WAV file we can read.
+static std::vector<int16_t> decodeWav(const std::vector<uint8_t> &wav)
+{
+    if(wav.size() < 12 || memcmp(wav.data(), "RIFF", 4) != 0 || memcmp(wav.data() + 8, "WAVE", 4) != 0) return {};
+    int channels = 0, rate = 0, bits = 0;
+    const uint8_t *data = NULL;
+    size_t dataSize = 0;
+    for(size_t at = 12; at + 8 <= wav.size();)
+    {
+        const uint8_t *chunk = wav.data() + at;
+        size_t size = std::min((size_t)get32(chunk + 4), wav.size() - at - 8);
+        if(memcmp(chunk, "fmt ", 4) == 0 && size >= 16 && get16(chunk + 8) == 1)
+        {
+            channels = get16(chunk + 10);
+            rate = get32(chunk + 12);
+            bits = get16(chunk + 22);
+        }
+        else if(memcmp(chunk, "data", 4) == 0)
+        {
+            data = chunk + 8;
+            dataSize = size;
+        }
+        at += 8 + size + (size & 1);
+    }
+    if(!data || channels == 0 || rate == 0 || bits != 16) return {};
+
+    size_t frames = dataSize / (2 * channels);
+    std::vector<int16_t> samples;
+    for(double position = 0; position + 1 < frames; position += (double)rate / kSampleRate)
+    {
+        size_t frame = position;
+        double mix = 0;
+        for(int c = 0; c < channels; c++)
+        {
+            double a = (int16_t)get16(data + 2 * (frame * channels + c));
+            double b = (int16_t)get16(data + 2 * ((frame + 1) * channels + c));
+            mix += a + (b - a) * (position - frame);
+        }
+        samples.push_back(mix / channels);
+    }
+    return samples;
+}
+
+// A kick on every beat and a hi-hat on every offbeat, over a noise floor
+static std::vector<int16_t> drumLoop(float bpm, float seconds)
+{
+    std::vector<int16_t> samples(kSampleRate * seconds);
+    double period = 60.0 / bpm * kSampleRate;
+    srand(1);
+    auto noise = []() { return (rand() % 2001 - 1000) / 1000.0; };
+    for(size_t i = 0; i < samples.size(); i++)
+    {
+        double x = 300 * noise();
+        double kick = fmod(i, period);
+        if(kick < 2000) x += 8000 * exp(-kick / 400) * sin(2 * M_PI * 60 * kick / kSampleRate) + 3000 * exp(-kick / 150) * noise();
+        double hat = fmod(i + period / 2, period);
+        if(hat < 800) x += 1500 * exp(-hat / 200) * noise();
+        samples[i] = std::max(-32768.0, std::min(32767.0, x));
+    }
+    return samples;
+}
+
+// Feeds the audio in DMA-buffer sized pieces, with the clock following along
+static float detectTempo(const std::vector<int16_t> &samples)
+{
+    std::unique_ptr<BeatDetector> detector(new BeatDetector()); // big; keep it off the stack
+    detector->setup();
+    const size_t kDmaSamples = 60;
+    for(size_t at = 0; at < samples.size(); at += kDmaSamples)
+    {
+        size_t count = std::min(kDmaSamples, samples.size() - at);
+        hostFeedI2s(&samples[at], count);
+        hostSetMicros((at + count) * 1000000LL / kSampleRate);
+        detector->update();
+    }
+    // what the beat clock on the render task sees
+    return detector->publishedState().bpm();
+}
+
+static TempoResult check(const char *name, const std::vector<uint8_t> &wav, float expected, const char *knownOctaveError = NULL)
+{
+    std::vector<int16_t> samples = decodeWav(wav);
+    if(samples.empty())
+    {
+        Serial.printf("%-24s FAIL, not a 16 bit PCM WAV file\n", name);
+        return TempoWrong;
+    }
+    if(samples.size() > kListenSeconds * kSampleRate) samples.resize(kListenSeconds * kSampleRate);
+    float bpm = detectTempo(samples);
+    TempoResult result = TempoWrong;
+    const char *description = "FAIL";
+    if(fabsf(bpm - expected) <= expected * kTolerance)
+    {
+        result = TempoExact;
+        description = knownOctaveError ? "ok, no longer a known limitation" : "ok";
+    }
+    else if(fabsf(bpm - expected / 2) <= expected / 2 * kTolerance || fabsf(bpm - expected * 2) <= expected * 2 * kTolerance)
+    {
+        result = TempoOctave;
+        description = knownOctaveError ? "known limitation, octave off" : "FAIL, octave off";
+    }
+    Serial.printf("%-24s %s, expected %.1f bpm, detected %.1f\n", name, description, expected, bpm);
+    if(result == TempoOctave && knownOctaveError) Serial.printf("%-24s (%s)\n", "", knownOctaveError);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    int failures = 0;
+    if(argc < 2)
+    {
+        int passed = 0, known = 0;
+        for(const DrumLoop &loop : kDrumLoops)
+        {
+            std::string name = "drum loop " + std::to_string((int)loop.bpm) + " bpm";
+            TempoResult result = check(name.c_str(), encodeWav(drumLoop(loop.bpm, kListenSeconds), kSampleRate), loop.bpm, loop.knownOctaveError);
+            if(result == TempoExact) passed++;
+            else if(result == TempoOctave && loop.knownOctaveError) known++;
+            else failures++;
+        }
+        Serial.printf("drum loops: %d ok, %d failed, %d off by an octave as known\n", passed, failures, known);
+    }
+    for(int i = 1; i < argc; i++)
+    {
+        std::string path = argv[i];
+        size_t suffix = path.rfind("bpm");
+        size_t digits = path.find_last_not_of("0123456789.", suffix - 1);
+        float expected = suffix == std::string::npos ? 0 : atof(path.substr(digits + 1, suffix - digits - 1).c_str());
+        FILE *file = fopen(path.c_str(), "rb");
+        if(!file || expected <= 0)
+        {
+            Serial.printf("%s: can't open, or no tempo in its name\n", path.c_str());
+            if(file) fclose(file);
+            failures++;
+            continue;
+        }
+        std::vector<uint8_t> wav;
+        uint8_t buffer[4096];
+        size_t read;
+        while((read = fread(buffer, 1, sizeof(buffer), file)) > 0) wav.insert(wav.end(), buffer, buffer + read);
+        fclose(file);
+        if(check(path.c_str(), wav, expected) != TempoExact) failures++;
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,51 @@
+// Runs the benchmark suites from Benchmark.h on this machine, printing the same CSV the
+// device does. Timings are of the desktop CPU, so they're for comparing one build of
+// the kernels with another, not for estimating frame rates on the device.
+//
+//   BenchmarkMain [blend|animation|composite|output ...]
+//
+// runs the named suites, or all of them.
+#include "Benchmark.h"
+
+struct Suite
+{
+    const char *name;
+    void (*run)(Print &out);
+};
+
+static const Suite kSuites[] = {
+    { "blend", benchmarkBlendModes },
+    { "animation", benchmarkAnimations },
+    { "composite", benchmarkComposite },
+    { "output", benchmarkOutput },
+};
+
+int main(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        runBenchmarks(Serial);
+        return 0;
+    }
+
+    const Suite *chosen[sizeof(kSuites) / sizeof(kSuites[0])];
+    int chosenCount = 0;
+    for(int i = 1; i < argc; i++)
+    {
+        const Suite *found = NULL;
+        for(const Suite &suite : kSuites)
+        {
+            if(strcmp(suite.name, argv[i]) == 0) found = &suite;
+        }
+        if(!found)
+        {
+            fprintf(stderr, "unknown suite %s\n", argv[i]);
+            return 1;
+        }
+        if(chosenCount < (int)(sizeof(chosen) / sizeof(chosen[0]))) chosen[chosenCount++] = found;
+    }
+
+    printBenchmarkHeader(Serial);
+    for(int i = 0; i < chosenCount; i++) chosen[i]->run(Serial);
+    return 0;
+}
@@ -0,0 +1,247 @@
+// Runs ClockSync on a handful of simulated cores with drifting crystals, connected by
+// links with jittery delays, and reports how long it takes until they all follow one
+// leader with mesh clocks that agree, and how far apart the clocks still are once settled
+// (over the last third of the run). Fails if a scenario misses its limits, unless it's
+// known to, which is reported as such.
+//
+// Like on the device, a central sends a request every CLOCK_SYNC_INTERVAL, and a
+// peripheral's response is a notification, so it reaches every central subscribed to it.
+#include "ClockSync.h"
+#include <Arduino.h>
+#include <random>
+#include <vector>
+
+static const int64_t kStep = 1000; // simulation step, us
+static const int64_t kSyncInterval = 1000000;
+static const int64_t kDuration = 300000000;
+static const int64_t kSettled = kDuration * 2 / 3;
+// Runs of each scenario, since who leads and how the crystals drift are random
+static const uint32_t kSeeds = 20;
+// What we aim for once settled: animations this far apart look like one
+static const double kTargetResidual = 5000;
+
+struct Link
+{
+    int central, peripheral;
+};
+
+struct Scenario
+{
+    const char *name;
+    int cores;
+    std::vector<Link> links;
+    // One-way delays, uniformly distributed, us; the way back can be slower
+    int64_t minDelay, maxDelay;
+    int64_t minReturnDelay, maxReturnDelay;
+    // The leader drops off the mesh at this time, if not 0
+    int64_t leaderLeavesAt;
+    // Mesh clocks this close count as agreeing, us
+    double agree;
+    // Limits: how long until they first follow one leader and agree (from the start, or
+    // from the leader leaving), and the worst disagreement once settled, us
+    double maxConvergence;
+    double maxResidual;
+    // Why this scenario is known to miss its limits, or NULL
+    const char *knownMiss;
+};
+
+struct Core
+{
+    ClockSync sync;
+    int64_t boot; // true time at which local time was 0
+    double skew;
+    bool present;
+    int64_t local(int64_t now) const { return (now - boot) * (1 + skew); }
+    double mesh(int64_t now) const { return sync.meshTime(local(now)); }
+};
+
+struct Message
+{
+    int64_t arrives;
+    int from, to;
+    ClockSyncPacket packet;
+};
+
+struct Result
+{
+    double convergence; // us until one leader and agreeing clocks, or -1 if never
+    double residual; // worst spread once settled, us
+    double rms;
+};
+
+static Result simulate(const Scenario &scenario, uint32_t seed)
+{
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<double> skew(-50e-6, 50e-6);
+    std::uniform_int_distribution<int64_t> boot(-100000000, 0);
+    std::uniform_int_distribution<int64_t> delay(scenario.minDelay, scenario.maxDelay);
+    std::uniform_int_distribution<int64_t> returnDelay(scenario.minReturnDelay, scenario.maxReturnDelay);
+
+    std::vector<Core> cores(scenario.cores);
+    int leader = 0;
+    for(int i = 0; i < scenario.cores; i++)
+    {
+        cores[i].boot = boot(random);
+        cores[i].skew = skew(random);
+        cores[i].present = true;
+        cores[i].sync.begin(random());
+        if(cores[i].sync.leader() > cores[leader].sync.leader()) leader = i;
+    }
+
+    std::vector<Message> inFlight;
+    Result result = { -1, 0, 0 };
+    double squares = 0;
+    int samples = 0;
+    int64_t settleFrom = 0; // after the leader leaves, convergence starts over
+    for(int64_t now = 0; now < kDuration; now += kStep)
+    {
+        if(scenario.leaderLeavesAt && now == scenario.leaderLeavesAt)
+        {
+            cores[leader].present = false;
+            result.convergence = -1;
+            settleFrom = now;
+        }
+
+        if(now % kSyncInterval == 0)
+        {
+            for(const Link &link : scenario.links)
+            {
+                Core &central = cores[link.central];
+                inFlight.push_back({ now + delay(random), link.central, link.peripheral, central.sync.makeRequest(central.local(now)) });
+            }
+        }
+
+        for(size_t i = 0; i < inFlight.size();)
+        {
+            if(inFlight[i].arrives > now)
+            {
+                i++;
+                continue;
+            }
+            Message message = inFlight[i];
+            inFlight.erase(inFlight.begin() + i);
+            Core &core = cores[message.to];
+            if(!core.present || !cores[message.from].present) continue;
+
+            int64_t local = core.local(now);
+            if(message.packet.type == ClockSyncRequest)
+            {
+                ClockSyncPacket response = core.sync.makeResponse(message.packet, local, local);
+                for(const Link &link : scenario.links)
+                {
+                    if(link.peripheral != message.to) continue;
+                    inFlight.push_back({ now + returnDelay(random), message.to, link.central, response });
+                }
+            }
+            else if(message.packet.type == ClockSyncResponse)
+            {
+                ClockSyncPacket adjust;
+                if(core.sync.handleResponse(message.packet, local, &adjust))
+                {
+                    inFlight.push_back({ now + delay(random), message.to, message.from, adjust });
+                }
+            }
+            else
+            {
+                core.sync.handleAdjust(message.packet, local);
+            }
+        }
+
+        double earliest = INFINITY, latest = -INFINITY;
+        uint32_t followed = 0;
+        bool oneLeader = true, leaderPresent = false;
+        for(Core &core : cores)
+        {
+            if(!core.present) continue;
+            core.sync.update(core.local(now));
+            earliest = min(earliest, core.mesh(now));
+            latest = max(latest, core.mesh(now));
+            if(followed && core.sync.leader() != followed) oneLeader = false;
+            followed = core.sync.leader();
+            if(core.sync.isLeader()) leaderPresent = true;
+        }
+        double spread = latest - earliest;
+
+        if(result.convergence < 0 && oneLeader && leaderPresent && spread < scenario.agree)
+        {
+            result.convergence = now - settleFrom;
+        }
+        if(now >= kSettled)
+        {
+            result.residual = max(result.residual, spread);
+            squares += spread * spread;
+            samples++;
+        }
+    }
+    result.rms = samples ? sqrt(squares / samples) : 0;
+    return result;
+}
+
+static std::vector<Link> chain(int cores)
+{
+    std::vector<Link> links;
+    for(int i = 0; i + 1 < cores; i++) links.push_back({ i, i + 1 });
+    return links;
+}
+
+// Every core a central to every other
+static std::vector<Link> fullMesh(int cores)
+{
+    std::vector<Link> links;
+    for(int i = 0; i < cores; i++)
+    {
+        for(int j = 0; j < cores; j++)
+        {
+            if(i != j) links.push_back({ i, j });
+        }
+    }
+    return links;
+}
+
+int main()
+{
+    // BLE connection intervals are 7.5 to 30 ms, and a packet waits up to a whole one
+    const Scenario scenarios[] = {
+        { "pair", 2, chain(2), 3000, 30000, 3000, 30000, 0, 5000, 5e6, kTargetResidual, NULL },
+        // each hop adds its own error to that of the one it follows, and the ends of the
+        // chain are four apart
+        { "chain of 5", 5, chain(5), 3000, 30000, 3000, 30000, 0, 10000, 20e6, kTargetResidual,
+            "errors add up over four hops" },
+        { "full mesh of 6", 6, fullMesh(6), 3000, 30000, 3000, 30000, 0, 10000, 20e6, kTargetResidual, NULL },
+        // a link that's consistently slower one way biases its offset by half the
+        // difference between the quickest trip each way, which nothing can measure:
+        // at least 7.5 ms here, so this only checks that it gets no worse
+        { "asymmetric pair", 2, chain(2), 5000, 10000, 20000, 40000, 0, 20000, 5e6, 12000, NULL },
+        // the rest count up to kMaxHops following each other, then time out and re-elect
+        { "leader leaves mesh of 5", 5, fullMesh(5), 3000, 30000, 3000, 30000, 100000000, 10000, 45e6, kTargetResidual, NULL },
+    };
+
+    int failures = 0;
+    for(const Scenario &scenario : scenarios)
+    {
+        double worstConvergence = 0, worstResidual = 0, worstRms = 0;
+        bool converged = true;
+        for(uint32_t seed = 1; seed <= kSeeds; seed++)
+        {
+            Result result = simulate(scenario, seed);
+            if(result.convergence < 0) converged = false;
+            worstConvergence = max(worstConvergence, result.convergence);
+            worstResidual = max(worstResidual, result.residual);
+            worstRms = max(worstRms, result.rms);
+        }
+        bool ok = converged && worstConvergence <= scenario.maxConvergence && worstResidual <= scenario.maxResidual;
+        const char *description = ok ? (scenario.knownMiss ? "ok, no longer a known miss" : "ok") : (scenario.knownMiss ? "known miss" : "FAIL");
+        if(converged)
+        {
+            Serial.printf("%-24s %s: within %.0f ms after %.2f s; settled, %.2f ms apart at worst (limit %.0f), %.2f ms rms\n",
+                scenario.name, description, scenario.agree / 1000, worstConvergence / 1e6, worstResidual / 1000, scenario.maxResidual / 1000, worstRms / 1000);
+        }
+        else
+        {
+            Serial.printf("%-24s %s: never within %.0f ms\n", scenario.name, description, scenario.agree / 1000);
+        }
+        if(!ok && scenario.knownMiss) Serial.printf("%-24s (%s)\n", "", scenario.knownMiss);
+        else if(!ok) failures++;
+    }
+    return failures ? 1 : 0;
+}
\ No newline at end of file
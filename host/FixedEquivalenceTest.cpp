@@ -0,0 +1,153 @@
+// Checks that every fixed-point kernel draws within 1 LSB per channel of its float
+// counterpart, over a grid of strip lengths, tau/phi values and times. Times stay under
+// a few minutes: past that the float kernels themselves run out of precision. Also checks
+// the SWAR blend kernels for Multiply and Screen against their per-byte formulas, for
+// every pair of levels.
+#include "Animations.h"
+#include "Compositor.h"
+#include <map>
+#include <vector>
+
+static const int kLengths[] = { 400, 800, 37, 1 };
+static const float kTaus[] = { 10, 3.3, -7, 0.5, 55 };
+static const float kPhis[] = { 4, 1, -2.5, 9, 0.3 };
+static const TimeInterval kTimes[] = { 0, 0.123, 1.77, 13.37, 61.5, 123.4567 };
+
+// Rainbow draws through CHSV, where one step of hue can move a channel by several
+// levels; so for colors on its hue wheel, compare hues instead.
+static std::map<uint32_t, int> rainbowHues()
+{
+    std::map<uint32_t, int> hues;
+    for(int hue = 0; hue < 256; hue++)
+    {
+        CRGB color = CHSV(hue, 240, 255);
+        hues.emplace((color.r << 16) | (color.g << 8) | color.b, hue);
+    }
+    return hues;
+}
+
+static int difference(const CRGB &a, const CRGB &b, const std::map<uint32_t, int> &hues)
+{
+    int worst = 0;
+    for(int c = 0; c < 3; c++) worst = max(worst, abs(a[c] - b[c]));
+    if(worst <= 1) return worst;
+
+    auto hueA = hues.find((a.r << 16) | (a.g << 8) | a.b);
+    auto hueB = hues.find((b.r << 16) | (b.g << 8) | b.b);
+    if(hueA == hues.end() || hueB == hues.end()) return worst;
+    int steps = abs(hueA->second - hueB->second);
+    return min(steps, 256 - steps);
+}
+
+struct BlendReference
+{
+    LayerBlendMode mode;
+    uint8_t (*channel)(uint8_t a, uint8_t b);
+};
+
+static const BlendReference kBlendReferences[] = {
+    { BlendModeMultiply, [](uint8_t a, uint8_t b) -> uint8_t { return (a * b) >> 8; } },
+    { BlendModeScreen, [](uint8_t a, uint8_t b) -> uint8_t { return 255 - (((255-a) * (255-b)) >> 8); } },
+};
+
+// Every pair of levels, at each alignment, so the words and the bytes around them are both
+// covered. Returns how many blend modes failed.
+static int checkBlendKernels()
+{
+    const int pairs = 256 * 256;
+    const int pixels = pairs / 3 + 2;
+    int failures = 0;
+    for(const BlendReference &reference : kBlendReferences)
+    {
+        long over = 0;
+        for(int offset = 0; offset < 4; offset++)
+        {
+            std::vector<CRGB> dst(pixels), src(pixels);
+            uint8_t *dstBytes = (uint8_t*)dst.data() + offset, *srcBytes = (uint8_t*)src.data() + offset;
+            for(int i = 0; i < pairs; i++)
+            {
+                dstBytes[i] = i >> 8;
+                srcBytes[i] = i & 0xFF;
+            }
+            // blend whole pixels starting offset bytes in, which is how misaligned spans look
+            blendSpanFor(reference.mode)((CRGB*)dstBytes, (const CRGB*)srcBytes, pairs / 3);
+            for(int i = 0; i < pairs / 3 * 3; i++)
+            {
+                uint8_t expected = reference.channel(i >> 8, i & 0xFF);
+                if(dstBytes[i] == expected) continue;
+                if(over++ < 3)
+                {
+                    Serial.printf("  %s: offset %d, %02x with %02x is %02x, expected %02x\n",
+                        blendModeNames[reference.mode].c_str(), offset, i >> 8, i & 0xFF, dstBytes[i], expected);
+                }
+            }
+        }
+        Serial.printf("%-16s %s\n", blendModeNames[reference.mode].c_str(), over ? "FAIL" : "ok");
+        if(over) failures++;
+    }
+    return failures;
+}
+
+int main()
+{
+    std::map<uint32_t, int> hues = rainbowHues();
+    std::vector<CRGB> floatPixels(800), fixedPixels(800);
+    SubStrip floatStrip(floatPixels.data(), 800), fixedStrip(fixedPixels.data(), 800);
+    NeighbourColors neighbours;
+    neighbours.count = 3;
+    neighbours.colors[0] = CRGB(255, 0, 0);
+    neighbours.colors[1] = CRGB(0, 200, 30);
+    neighbours.colors[2] = CRGB(7, 7, 250);
+
+    int failures = 0;
+    for(size_t animation = 1; animation < animationFuncs.size(); animation++)
+    {
+        int worst = 0;
+        long over = 0;
+        for(int length : kLengths)
+        {
+            for(float tau : kTaus)
+            {
+                for(float phi : kPhis)
+                {
+                    ShinyLayerSettings prefs;
+                    prefs.animationIndex = animation;
+                    prefs.p_tau = tau;
+                    prefs.p_phi = phi;
+                    prefs.mainColor = CRGB(255, 100, 7);
+                    prefs.secondaryColor = CRGB(240, 255, 33);
+                    LayerAnimation floatLayer(&floatStrip, &floatStrip, &prefs);
+                    LayerAnimation fixedLayer(&fixedStrip, &fixedStrip, &prefs);
+                    floatLayer.neighbours = fixedLayer.neighbours = &neighbours;
+                    floatLayer.canvas = SubStrip(floatPixels.data(), length);
+                    fixedLayer.canvas = SubStrip(fixedPixels.data(), length);
+
+                    for(TimeInterval t : kTimes)
+                    {
+                        animationFuncs[animation](&floatLayer, t);
+                        fixedAnimationFuncs[animation](&fixedLayer, t);
+                        for(int i = 0; i < length; i++)
+                        {
+                            int d = difference(floatPixels[i], fixedPixels[i], hues);
+                            if(d <= 1) continue;
+                            if(over++ < 3)
+                            {
+                                Serial.printf("  %s: %d pixels, tau %g, phi %g, t %g, pixel %d: %02x%02x%02x vs %02x%02x%02x\n",
+                                    animationNames[animation].c_str(), length, tau, phi, t, i,
+                                    floatPixels[i].r, floatPixels[i].g, floatPixels[i].b,
+                                    fixedPixels[i].r, fixedPixels[i].g, fixedPixels[i].b);
+                            }
+                            worst = max(worst, d);
+                        }
+                    }
+                }
+            }
+        }
+        Serial.printf("%-16s %s", animationNames[animation].c_str(), over ? "FAIL" : "ok");
+        if(over) Serial.printf(", %ld pixels off by up to %d", over, worst);
+        Serial.println();
+        if(over) failures++;
+    }
+    failures += checkBlendKernels();
+    return failures ? 1 : 0;
+}
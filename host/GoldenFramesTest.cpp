@@ -0,0 +1,16 @@
+// Checks the render kernels against the goldens in GoldenFrames.cpp; fails on any case
+// that's different or has no golden.
+//
+//   GoldenFramesTest           checks
+//   GoldenFramesTest capture   prints every case as a kGoldenFrames entry instead
+#include "GoldenFrames.h"
+
+int main(int argc, char **argv)
+{
+    if(argc > 1 && strcmp(argv[1], "capture") == 0)
+    {
+        captureGoldenFrames(Serial);
+        return 0;
+    }
+    return checkGoldenFrames(Serial) > 0 ? 1 : 0;
+}
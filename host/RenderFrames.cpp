@@ -0,0 +1,414 @@
+// Renders a scene offline, much faster than real time, to preview animations without a
+// strip attached.
+//
+//   RenderFrames [-j THREADS] [-r ROWS] SCENE SECONDS FPS raw|ppm|y4m > OUT
+//
+// SCENE is either a .json file (see below) or a file in the binary scene format of
+// SceneCodec.h, applied onto the default settings. Frames start at time 0 on the wall
+// clock and go to stdout as:
+//   raw  each frame's pixels as RGB bytes, back to back
+//   ppm  a binary PPM image with a row of pixels per frame, top to bottom: a timeline
+//   y4m  a YUV4MPEG2 video, each frame ROWS (default 16) rows of the strip tall; e.g.
+//        RenderFrames show.json 60 30 y4m | ffmpeg -i - show.mp4
+// Pixels are as composited: before brightness, color order and LED layout.
+//
+// Animations draw any time independently of the ones before it, so frames are rendered
+// on THREADS threads (default: one per core), each with its own layers. The random
+// animations (Sparkle, and the Dissolve blend mode) draw from a generator per thread,
+// so their output depends on the number of threads.
+//
+// The JSON takes the names and values of the BLE properties (see Comms.h), with layers
+// as an array in layer order; numbers can be given as numbers or as strings:
+//   {
+//     "ledCount": 400,
+//     "ledSegments": "0 120;120 80",
+//     "layers": [
+//       { "animation": "Single Wave", "speed": 2, "color1": "255 100 0", "tau": 10 },
+//       { "animation": "Sparkle", "blendMode": "Screen", "segment": 1, "fixedPoint": false }
+//     ]
+//   }
+// Layers left out draw nothing.
+#include "Compositor.h"
+#include "SceneCodec.h"
+#include "Util.h"
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern std::vector<String> animationNames;
+
+// Just enough JSON for scene files
+struct JsonValue
+{
+    enum Type { Null, Bool, Number, Text, Array, Object } type = Null;
+    bool boolean = false;
+    double number = 0;
+    std::string text;
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue>> members;
+};
+
+class JsonParser
+{
+public:
+    JsonParser(const char *text) : _p(text) {}
+
+    // Returns false if text isn't a single JSON value
+    bool parse(JsonValue &value)
+    {
+        if(!parseValue(value)) return false;
+        skipSpace();
+        return *_p == 0;
+    }
+private:
+    const char *_p;
+
+    void skipSpace()
+    {
+        while(*_p == ' ' || *_p == '\t' || *_p == '\n' || *_p == '\r') _p++;
+    }
+
+    bool literal(const char *word)
+    {
+        size_t length = strlen(word);
+        if(strncmp(_p, word, length) != 0) return false;
+        _p += length;
+        return true;
+    }
+
+    bool parseString(std::string &out)
+    {
+        if(*_p++ != '"') return false;
+        while(*_p != '"')
+        {
+            char c = *_p++;
+            if(c == 0) return false;
+            if(c != '\\')
+            {
+                out += c;
+                continue;
+            }
+            c = *_p++;
+            switch(c)
+            {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u':
+                {
+                    // names are ASCII; anything else becomes '?'
+                    char digits[5] = { 0 };
+                    for(int i = 0; i < 4; i++) if(!(digits[i] = *_p++)) return false;
+                    long code = strtol(digits, NULL, 16);
+                    out += code < 0x80 ? (char)code : '?';
+                    break;
+                }
+                case 0: return false;
+                default: out += c; break;
+            }
+        }
+        _p++;
+        return true;
+    }
+
+    bool parseValue(JsonValue &value)
+    {
+        skipSpace();
+        if(*_p == '{')
+        {
+            value.type = JsonValue::Object;
+            _p++;
+            skipSpace();
+            if(*_p == '}') { _p++; return true; }
+            while(true)
+            {
+                std::pair<std::string, JsonValue> member;
+                skipSpace();
+                if(!parseString(member.first)) return false;
+                skipSpace();
+                if(*_p++ != ':' || !parseValue(member.second)) return false;
+                value.members.push_back(member);
+                skipSpace();
+                if(*_p == '}') { _p++; return true; }
+                if(*_p++ != ',') return false;
+            }
+        }
+        if(*_p == '[')
+        {
+            value.type = JsonValue::Array;
+            _p++;
+            skipSpace();
+            if(*_p == ']') { _p++; return true; }
+            while(true)
+            {
+                value.items.emplace_back();
+                if(!parseValue(value.items.back())) return false;
+                skipSpace();
+                if(*_p == ']') { _p++; return true; }
+                if(*_p++ != ',') return false;
+            }
+        }
+        if(*_p == '"')
+        {
+            value.type = JsonValue::Text;
+            return parseString(value.text);
+        }
+        if(literal("true")) { value.type = JsonValue::Bool; value.boolean = true; return true; }
+        if(literal("false")) { value.type = JsonValue::Bool; return true; }
+        if(literal("null")) return true;
+
+        char *end;
+        value.type = JsonValue::Number;
+        value.number = strtod(_p, &end);
+        if(end == _p) return false;
+        _p = end;
+        return true;
+    }
+};
+
+static void fail(const char *message, const char *detail = "")
+{
+    fprintf(stderr, "%s%s\n", message, detail);
+    exit(1);
+}
+
+// A property's value as the string it'd be written as over BLE
+static std::string propertyString(const JsonValue &value, const char *key)
+{
+    if(value.type == JsonValue::Text) return value.text;
+    if(value.type == JsonValue::Bool) return value.boolean ? "1" : "0";
+    if(value.type == JsonValue::Number)
+    {
+        char number[32];
+        snprintf(number, sizeof(number), "%.9g", value.number);
+        return number;
+    }
+    fail("expected a string or number for ", key);
+    return "";
+}
+
+static int nameIndex(const std::vector<String> &names, const std::string &name, const char *key)
+{
+    int index = NameIndex(names).find(name.c_str());
+    if(index < 0)
+    {
+        fprintf(stderr, "unknown %s %s\n", key, name.c_str());
+        exit(1);
+    }
+    return index;
+}
+
+static void applyLayerJson(const JsonValue &json, ShinyLayerSettings &layer)
+{
+    if(json.type != JsonValue::Object) fail("expected an object for each layer");
+    for(const auto &member : json.members)
+    {
+        const char *key = member.first.c_str();
+        std::string value = propertyString(member.second, key);
+        if(member.first == "animation") layer.animationIndex = nameIndex(animationNames, value, key);
+        else if(member.first == "blendMode") layer.blendMode = (LayerBlendMode)nameIndex(blendModeNames, value, key);
+        else if(member.first == "speed") layer.speed = atof(value.c_str());
+        else if(member.first == "color1") layer.mainColor = rgbFromString(value.c_str());
+        else if(member.first == "color2") layer.secondaryColor = rgbFromString(value.c_str());
+        else if(member.first == "tau") layer.p_tau = atof(value.c_str());
+        else if(member.first == "phi") layer.p_phi = atof(value.c_str());
+        else if(member.first == "segment")
+        {
+            long segment = strtol(value.c_str(), NULL, 10);
+            layer.segment = constrain(segment, 0, SEGMENT_COUNT);
+        }
+        else if(member.first == "fixedPoint") layer.fixedPoint = atoi(value.c_str()) != 0;
+        else fail("unknown layer property ", key);
+    }
+}
+
+static void applySettingsJson(const JsonValue &json, ShinySettings &settings)
+{
+    if(json.type != JsonValue::Object) fail("expected an object at the top of the scene");
+    for(const auto &member : json.members)
+    {
+        const char *key = member.first.c_str();
+        if(member.first == "layers")
+        {
+            if(member.second.type != JsonValue::Array) fail("expected an array for layers");
+            if(member.second.items.size() > LAYER_COUNT) fail("too many layers");
+            for(size_t i = 0; i < member.second.items.size(); i++)
+            {
+                applyLayerJson(member.second.items[i], settings.layers[i]);
+            }
+            continue;
+        }
+
+        std::string value = propertyString(member.second, key);
+        if(member.first == "ledCount")
+        {
+            long count = strtol(value.c_str(), NULL, 10);
+            settings.ledCount = constrain(count, 0, MAX_LED_COUNT);
+        }
+        else if(member.first == "ledSegments") ledSegmentsFromString(value.c_str(), settings.segments);
+        else fail("unknown property ", key);
+    }
+}
+
+static std::string readFile(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if(!file) fail("can't open ", path);
+    std::string contents;
+    char chunk[4096];
+    size_t length;
+    while((length = fread(chunk, 1, sizeof(chunk), file)) > 0) contents.append(chunk, length);
+    fclose(file);
+    return contents;
+}
+
+static ShinySettings loadScene(const char *path)
+{
+    ShinySettings settings;
+    std::string contents = readFile(path);
+    size_t pathLength = strlen(path);
+    if(pathLength > 5 && strcmp(path + pathLength - 5, ".json") == 0)
+    {
+        JsonValue json;
+        if(!JsonParser(contents.c_str()).parse(json)) fail("invalid JSON in ", path);
+        applySettingsJson(json, settings);
+    }
+    else
+    {
+        SceneUpdate scene;
+        if(!decodeScene((const uint8_t*)contents.data(), contents.size(), &scene)) fail("invalid scene in ", path);
+        applySceneTo(scene, settings);
+    }
+    return settings;
+}
+
+// One thread's layers and buffers. They point at each other, so it stays where it's made.
+class FrameRenderer
+{
+public:
+    FrameRenderer(const ShinySettings &settings)
+      : _prefs(settings), _front(settings.ledCount), _back(settings.ledCount), _cache(settings.ledCount),
+        _frontbuffer(_front.data(), settings.ledCount), _backbuffer(_back.data(), settings.ledCount),
+        _compositor(NULL, 0, NULL)
+    {
+        _layers.reserve(LAYER_COUNT);
+        for(int i = 0; i < LAYER_COUNT; i++)
+        {
+            _layers.emplace_back(&_backbuffer, &_frontbuffer, &_prefs.layers[i]);
+            _layers.back().neighbours = &_prefs.neighbours;
+            _layers.back().segments = _prefs.segments;
+        }
+        _compositor = Compositor(_layers.data(), LAYER_COUNT, _cache.data());
+    }
+    FrameRenderer(const FrameRenderer &) = delete;
+
+    void render(TimeInterval t, CRGB *out)
+    {
+        for(int i = 0; i < LAYER_COUNT; i++)
+        {
+            // as in advanceLayers(): speed is how long one cycle takes, in clock units
+            float speed = _prefs.layers[i].speed;
+            _layers[i].advance(t, speed > 0 ? 1.0f / speed : 0.0f);
+        }
+        // unchanged frames are still output, and the strip still holds them
+        _compositor.composite();
+        memcpy(out, _front.data(), _front.size() * sizeof(CRGB));
+    }
+private:
+    ShinySettings _prefs;
+    std::vector<CRGB> _front, _back, _cache;
+    SubStrip _frontbuffer, _backbuffer;
+    std::vector<LayerAnimation> _layers;
+    Compositor _compositor;
+};
+
+enum OutputFormat { OutputRaw, OutputPPM, OutputY4M, OutputFormatCount };
+static const std::vector<String> outputFormatNames = { "raw", "ppm", "y4m" };
+
+// BT.601, studio range, as y4m readers assume
+static void writeY4MFrame(const CRGB *pixels, int count, int rows, std::vector<uint8_t> &planes)
+{
+    planes.resize(3 * count * rows);
+    uint8_t *y = planes.data(), *cb = y + count * rows, *cr = cb + count * rows;
+    for(int i = 0; i < count; i++)
+    {
+        int r = pixels[i].r, g = pixels[i].g, b = pixels[i].b;
+        y[i] = 16 + ((66 * r + 129 * g + 25 * b + 128) >> 8);
+        cb[i] = 128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8);
+        cr[i] = 128 + ((112 * r - 94 * g - 18 * b + 128) >> 8);
+    }
+    for(int row = 1; row < rows; row++)
+    {
+        memcpy(y + row * count, y, count);
+        memcpy(cb + row * count, cb, count);
+        memcpy(cr + row * count, cr, count);
+    }
+    fputs("FRAME\n", stdout);
+    fwrite(planes.data(), 1, planes.size(), stdout);
+}
+
+static void usage()
+{
+    fail("usage: RenderFrames [-j THREADS] [-r ROWS] SCENE SECONDS FPS raw|ppm|y4m > OUT");
+}
+
+int main(int argc, char **argv)
+{
+    int threadCount = max(1, (int)std::thread::hardware_concurrency());
+    int rows = 16;
+    int arg = 1;
+    for(; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)
+    {
+        if(strcmp(argv[arg], "-j") == 0) threadCount = atoi(argv[arg + 1]);
+        else if(strcmp(argv[arg], "-r") == 0) rows = atoi(argv[arg + 1]);
+        else usage();
+    }
+    if(argc - arg != 4) usage();
+    ShinySettings settings = loadScene(argv[arg]);
+    float seconds = atof(argv[arg + 1]);
+    int fps = atoi(argv[arg + 2]);
+    int format = NameIndex(outputFormatNames).find(argv[arg + 3]);
+    if(seconds <= 0 || fps <= 0 || format < 0 || threadCount < 1 || rows < 1) usage();
+    int pixels = settings.ledCount;
+    if(pixels < 1) fail("the scene has no pixels");
+    int frames = (int)(seconds * fps);
+
+    if(format == OutputPPM) printf("P6\n%d %d\n255\n", pixels, frames);
+    if(format == OutputY4M) printf("YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", pixels, rows, fps);
+
+    std::vector<std::unique_ptr<FrameRenderer>> renderers;
+    for(int i = 0; i < threadCount; i++) renderers.emplace_back(new FrameRenderer(settings));
+
+    // Each thread renders a run of consecutive frames of every batch, which is then
+    // written out in order, so memory use doesn't grow with the length of the show.
+    const int kFramesPerRun = 16;
+    int batchFrames = threadCount * kFramesPerRun;
+    std::vector<CRGB> batch(batchFrames * pixels);
+    std::vector<uint8_t> planes;
+    for(int first = 0; first < frames; first += batchFrames)
+    {
+        int count = min(batchFrames, frames - first);
+        std::vector<std::thread> threads;
+        for(int i = 0; i < threadCount && i * kFramesPerRun < count; i++)
+        {
+            threads.emplace_back([&, i]() {
+                int end = min((i + 1) * kFramesPerRun, count);
+                for(int frame = i * kFramesPerRun; frame < end; frame++)
+                {
+                    renderers[i]->render((TimeInterval)(first + frame) / fps, &batch[frame * pixels]);
+                }
+            });
+        }
+        for(std::thread &thread : threads) thread.join();
+
+        for(int frame = 0; frame < count; frame++)
+        {
+            if(format == OutputY4M) writeY4MFrame(&batch[frame * pixels], pixels, rows, planes);
+            else fwrite(&batch[frame * pixels], sizeof(CRGB), pixels, stdout);
+        }
+    }
+    return ferror(stdout) ? 1 : 0;
+}
@@ -0,0 +1,101 @@
+// Checks that a scene survives encodeScene(), decodeScene() and applySceneTo() with every
+// field intact, that a partial write only touches what it carries, and that scenes with
+// out of range values or missing bytes are turned away.
+#include "SceneCodec.h"
+#include "Animations.h"
+#include <vector>
+
+static ShinySettings exampleScene()
+{
+    ShinySettings settings;
+    settings.mode = (RunMode)1;
+    for(int i = 0; i < LAYER_COUNT; i++)
+    {
+        // every other layer off, so the full flag has something to turn off
+        if(i % 2) continue;
+        ShinyLayerSettings &layer = settings.layers[i];
+        layer.animationIndex = 1 + i % (animationNames.size() - 1);
+        layer.mainColor = CRGB(i * 20, 255 - i, 7);
+        layer.secondaryColor = CRGB(3, i * 9, 200);
+        layer.blendMode = (LayerBlendMode)(i % BlendModeCount);
+        layer.speed = 0.25f + i;
+        layer.p_tau = -3.5f * i;
+        layer.p_phi = 1.0f / (i + 1);
+        layer.segment = i % (SEGMENT_COUNT + 1);
+    }
+    return settings;
+}
+
+static bool check(const char *name, bool ok)
+{
+    Serial.printf("%-32s %s\n", name, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+static bool roundTrip()
+{
+    ShinySettings original = exampleScene();
+    uint8_t data[SCENE_MAX_SIZE];
+    int length = encodeScene(original, 42, data);
+    SceneUpdate scene;
+    if(length > SCENE_MAX_SIZE || !decodeScene(data, length, &scene)) return false;
+    if(scene.mode != original.mode || scene.brightness != 42) return false;
+
+    // Start from something else entirely, so nothing matches by accident
+    ShinySettings decoded;
+    for(ShinyLayerSettings &layer : decoded.layers) layer.animationIndex = 1;
+    applySceneTo(scene, decoded);
+    for(int i = 0; i < LAYER_COUNT; i++)
+    {
+        if(decoded.layers[i] != original.layers[i]) return false;
+    }
+    return decoded.mode == original.mode;
+}
+
+static bool fullScene()
+{
+    ShinySettings original;
+    for(int i = 0; i < LAYER_COUNT; i++) original.layers[i].animationIndex = 1;
+    for(int i = 0; i < LAYER_COUNT; i++) original.layers[i].segment = SEGMENT_COUNT;
+    uint8_t data[SCENE_MAX_SIZE];
+    return encodeScene(original, 255, data) == SCENE_MAX_SIZE;
+}
+
+static bool partialWrite()
+{
+    // Layer 2's segment, and nothing else
+    const uint8_t data[] = { SCENE_VERSION, 0, 0, 1 << 2, 0, SceneFieldSegment, SEGMENT_COUNT };
+    SceneUpdate scene;
+    if(!decodeScene(data, sizeof(data), &scene)) return false;
+
+    ShinySettings original = exampleScene();
+    ShinySettings updated = original;
+    applySceneTo(scene, updated);
+    for(int i = 0; i < LAYER_COUNT; i++)
+    {
+        ShinyLayerSettings expected = original.layers[i];
+        if(i == 2) expected.segment = SEGMENT_COUNT;
+        if(updated.layers[i] != expected) return false;
+    }
+    return true;
+}
+
+static bool rejects(std::vector<uint8_t> data)
+{
+    SceneUpdate scene;
+    return !decodeScene(data.data(), data.size(), &scene);
+}
+
+int main()
+{
+    int failures = 0;
+    failures += !check("round trip", roundTrip());
+    failures += !check("full scene fits", fullScene());
+    failures += !check("partial write", partialWrite());
+    failures += !check("rejects segment out of range", rejects({ SCENE_VERSION, 0, 0, 1, 0, SceneFieldSegment, SEGMENT_COUNT + 1 }));
+    failures += !check("rejects blend mode out of range", rejects({ SCENE_VERSION, 0, 0, 1, 0, SceneFieldBlendMode, BlendModeCount }));
+    failures += !check("rejects missing bytes", rejects({ SCENE_VERSION, 0, 0, 1, 0, SceneFieldSegment }));
+    failures += !check("rejects bytes left over", rejects({ SCENE_VERSION, 0, 0, 1, 0, SceneFieldSegment, 1, 0 }));
+    failures += !check("rejects other versions", rejects({ SCENE_VERSION + 1, 0, 0, 0, 0 }));
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+#ifndef __HOST_ARDUINO__H
+#define __HOST_ARDUINO__H
+// Just enough of the Arduino core for the render path to build and run on a desktop
+// machine; see host/Makefile. Only what the sketch's portable sources use is here.
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+
+using std::min;
+using std::max;
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+class String
+{
+public:
+    String() {}
+    String(const char *str) : _s(str ? str : "") {}
+    String(const std::string &str) : _s(str) {}
+    explicit String(int value) : _s(std::to_string(value)) {}
+    explicit String(unsigned value) : _s(std::to_string(value)) {}
+    explicit String(long value) : _s(std::to_string(value)) {}
+    explicit String(unsigned long value) : _s(std::to_string(value)) {}
+
+    const char *c_str() const { return _s.c_str(); }
+    unsigned length() const { return _s.size(); }
+    bool isEmpty() const { return _s.empty(); }
+    bool operator==(const String &other) const { return _s == other._s; }
+    bool operator!=(const String &other) const { return _s != other._s; }
+    bool operator<(const String &other) const { return _s < other._s; }
+    bool startsWith(const String &prefix) const { return _s.compare(0, prefix._s.size(), prefix._s) == 0; }
+    String substring(unsigned from) const { return from < _s.size() ? String(_s.substr(from)) : String(); }
+    String substring(unsigned from, unsigned to) const { return from < _s.size() ? String(_s.substr(from, to - from)) : String(); }
+    long toInt() const { return atol(_s.c_str()); }
+    float toFloat() const { return atof(_s.c_str()); }
+    char operator[](unsigned i) const { return _s[i]; }
+    String &operator+=(const String &other) { _s += other._s; return *this; }
+    friend String operator+(const String &a, const String &b) { return String(a._s + b._s); }
+private:
+    std::string _s;
+};
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+        size_t written = 0;
+        while(size--) written += write(*buffer++);
+        return written;
+    }
+    size_t write(const char *str) { return write((const uint8_t*)str, strlen(str)); }
+
+    size_t print(const char *str) { return write(str); }
+    size_t print(const String &str) { return write(str.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int value) { return printf("%d", value); }
+    size_t print(unsigned value) { return printf("%u", value); }
+    size_t print(long value) { return printf("%ld", value); }
+    size_t print(unsigned long value) { return printf("%lu", value); }
+    size_t print(double value, int digits = 2) { return printf("%.*f", digits, value); }
+    size_t println() { return write("\r\n"); }
+    template<typename T> size_t println(T value) { size_t written = print(value); return written + println(); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        char buffer[512];
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        return write((const uint8_t*)buffer, std::min(length, (int)sizeof(buffer) - 1));
+    }
+};
+
+// Serial is standard output
+class HardwareSerial : public Print
+{
+public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t c) override { return fwrite(&c, 1, 1, stdout); }
+    size_t write(const uint8_t *buffer, size_t size) override { return fwrite(buffer, 1, size, stdout); }
+    using Print::write;
+};
+extern HardwareSerial Serial;
+
+unsigned long millis();
+unsigned long micros();
+long random(long howBig);
+long random(long howSmall, long howBig);
+
+// Host only: the clock behind millis(), micros() and esp_timer_get_time(). It follows
+// the real time until a test sets it, and from then on only moves when set again.
+void hostSetMicros(int64_t micros);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __HOST_M5UNIFIED__H
+#define __HOST_M5UNIFIED__H
+// No displays on the host, so logger only writes to Serial
+#include "Arduino.h"
+
+class M5GFX : public Print
+{
+public:
+    size_t write(uint8_t) override { return 1; }
+    using Print::write;
+};
+
+class M5Unified
+{
+public:
+    int getDisplayCount() { return 0; }
+    M5GFX &getDisplay(int) { return _display; }
+private:
+    M5GFX _display;
+};
+extern M5Unified M5;
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef __HOST_OVERANIMATE__H
+#define __HOST_OVERANIMATE__H
+// The parts of OverAnimate the render path uses.
+//
+// gammaf() and CRGB * float stand in for the library's: a 2.2 power curve, and scaling
+// that truncates each channel. Golden frames of the float kernels depend on both, so
+// keep them in line with the library if it changes.
+#include "FastLED.h"
+
+typedef double TimeInterval;
+
+inline float gammaf(float x)
+{
+    return powf(x, 2.2f);
+}
+
+inline CRGB operator*(const CRGB &color, float factor)
+{
+    return CRGB(color.r * factor, color.g * factor, color.b * factor);
+}
+
+#endif
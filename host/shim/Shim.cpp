@@ -0,0 +1,147 @@
+#include "Arduino.h"
+#include "FastLED.h"
+#include "M5Unified.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "driver/i2s.h"
+#include <chrono>
+#include <atomic>
+#include <deque>
+
+HardwareSerial Serial;
+M5Unified M5;
+
+static std::atomic<int64_t> fakeMicros(-1);
+
+void hostSetMicros(int64_t micros)
+{
+    fakeMicros = micros;
+}
+
+int64_t esp_timer_get_time()
+{
+    int64_t fake = fakeMicros;
+    if(fake >= 0) return fake;
+    static const auto started = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+}
+
+unsigned long micros()
+{
+    return esp_timer_get_time();
+}
+
+unsigned long millis()
+{
+    return esp_timer_get_time() / 1000;
+}
+
+long random(long howBig)
+{
+    return howBig > 0 ? rand() % howBig : 0;
+}
+
+long random(long howSmall, long howBig)
+{
+    return howSmall < howBig ? howSmall + random(howBig - howSmall) : howSmall;
+}
+
+size_t heap_caps_get_free_size(uint32_t)
+{
+    return 0;
+}
+
+// FastLED's 16 bit LCG, with its default seed; one per thread, so tools can render on
+// several at once
+static thread_local uint16_t rand16seed = 1337;
+
+uint16_t random16()
+{
+    rand16seed = rand16seed * 2053 + 13849;
+    return rand16seed;
+}
+
+void random16_set_seed(uint16_t seed)
+{
+    rand16seed = seed;
+}
+
+uint8_t random8()
+{
+    random16();
+    return (uint8_t)((rand16seed & 0xFF) + (rand16seed >> 8));
+}
+
+uint8_t random8(uint8_t lim)
+{
+    return (random8() * lim) >> 8;
+}
+
+// FastLED's "rainbow" hue mapping (yellow boosted, green unscaled)
+void hsv2rgb_rainbow(const CHSV &hsv, CRGB &rgb)
+{
+    uint8_t hue = hsv.hue, sat = hsv.sat, val = hsv.val;
+    uint8_t offset8 = (hue & 0x1F) << 3;
+    uint8_t third = scale8(offset8, 256 / 3);
+    uint8_t twothirds = scale8(offset8, (256 * 2) / 3);
+    uint8_t r, g, b;
+
+    switch(hue >> 5)
+    {
+    case 0: r = 255 - third; g = third; b = 0; break;             // red to orange
+    case 1: r = 171; g = 85 + third; b = 0; break;                // orange to yellow
+    case 2: r = 171 - twothirds; g = 170 + third; b = 0; break;   // yellow to green
+    case 3: r = 0; g = 255 - third; b = third; break;             // green to aqua
+    case 4: r = 0; g = 171 - twothirds; b = 85 + twothirds; break; // aqua to blue
+    case 5: r = third; g = 0; b = 255 - third; break;             // blue to purple
+    case 6: r = 85 + third; g = 0; b = 171 - third; break;        // purple to pink
+    default: r = 170 + third; g = 0; b = 85 - third; break;       // pink to red
+    }
+
+    if(sat != 255)
+    {
+        if(sat == 0)
+        {
+            r = g = b = 255;
+        }
+        else
+        {
+            uint8_t desat = scale8_video(255 - sat, 255 - sat);
+            uint8_t satscale = 255 - desat;
+            r = scale8(r, satscale) + desat;
+            g = scale8(g, satscale) + desat;
+            b = scale8(b, satscale) + desat;
+        }
+    }
+
+    if(val != 255)
+    {
+        val = scale8_video(val, val);
+        r = scale8(r, val);
+        g = scale8(g, val);
+        b = scale8(b, val);
+    }
+
+    rgb = CRGB(r, g, b);
+}
+
+static std::deque<int16_t> i2sSamples;
+
+void hostFeedI2s(const int16_t *samples, size_t count)
+{
+    i2sSamples.insert(i2sSamples.end(), samples, samples + count);
+}
+
+esp_err_t i2s_driver_install(i2s_port_t, const i2s_config_t *, int, void *) { return ESP_OK; }
+esp_err_t i2s_driver_uninstall(i2s_port_t) { return ESP_OK; }
+esp_err_t i2s_set_pin(i2s_port_t, const i2s_pin_config_t *) { return ESP_OK; }
+esp_err_t i2s_set_clk(i2s_port_t, uint32_t, i2s_bits_per_sample_t, i2s_channel_t) { return ESP_OK; }
+
+esp_err_t i2s_read(i2s_port_t, void *dest, size_t size, size_t *bytesRead, uint32_t)
+{
+    size_t count = std::min(size / 2, i2sSamples.size());
+    std::copy(i2sSamples.begin(), i2sSamples.begin() + count, (int16_t*)dest);
+    i2sSamples.erase(i2sSamples.begin(), i2sSamples.begin() + count);
+    *bytesRead = count * 2;
+    return ESP_OK;
+}
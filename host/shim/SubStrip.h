@@ -0,0 +1,21 @@
+#ifndef __HOST_SUBSTRIP__H
+#define __HOST_SUBSTRIP__H
+// A window of count pixels onto someone else's CRGB array
+#include "FastLED.h"
+
+class SubStrip
+{
+public:
+    SubStrip(CRGB *leds, int count) : _leds(leds), _count(count) {}
+
+    int numPixels() { return _count; }
+    void setNumPixels(int count) { _count = count; }
+    CRGB &operator[](int i) { return _leds[i]; }
+    void set(int i, CRGB color) { _leds[i] = color; }
+    void fill(CRGB color) { for(int i = 0; i < _count; i++) _leds[i] = color; }
+private:
+    CRGB *_leds;
+    int _count;
+};
+
+#endif
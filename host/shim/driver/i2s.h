@@ -0,0 +1,46 @@
+#ifndef __HOST_DRIVER_I2S__H
+#define __HOST_DRIVER_I2S__H
+// A microphone that plays back whatever hostFeedI2s() was given, for testing the beat
+// detector with recorded audio. Configuration calls all succeed and are ignored.
+#include "Arduino.h"
+
+typedef int esp_err_t;
+#define ESP_OK 0
+
+typedef enum { I2S_NUM_0 = 0 } i2s_port_t;
+typedef enum { I2S_MODE_MASTER = 1, I2S_MODE_RX = 4, I2S_MODE_PDM = 64 } i2s_mode_t;
+typedef enum { I2S_BITS_PER_SAMPLE_16BIT = 16 } i2s_bits_per_sample_t;
+typedef enum { I2S_CHANNEL_FMT_ALL_RIGHT = 2 } i2s_channel_fmt_t;
+typedef enum { I2S_COMM_FORMAT_I2S = 1 } i2s_comm_format_t;
+typedef enum { I2S_CHANNEL_MONO = 1 } i2s_channel_t;
+#define ESP_INTR_FLAG_LEVEL1 (1 << 1)
+
+typedef struct {
+    i2s_mode_t mode;
+    int sample_rate;
+    i2s_bits_per_sample_t bits_per_sample;
+    i2s_channel_fmt_t channel_format;
+    i2s_comm_format_t communication_format;
+    int intr_alloc_flags;
+    int dma_buf_count;
+    int dma_buf_len;
+} i2s_config_t;
+
+typedef struct {
+    int bck_io_num;
+    int ws_io_num;
+    int data_out_num;
+    int data_in_num;
+} i2s_pin_config_t;
+
+esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t *config, int queueSize, void *queue);
+esp_err_t i2s_driver_uninstall(i2s_port_t port);
+esp_err_t i2s_set_pin(i2s_port_t port, const i2s_pin_config_t *pins);
+esp_err_t i2s_set_clk(i2s_port_t port, uint32_t rate, i2s_bits_per_sample_t bits, i2s_channel_t channels);
+// Never waits: returns what has been fed and not read yet, up to size bytes
+esp_err_t i2s_read(i2s_port_t port, void *dest, size_t size, size_t *bytesRead, uint32_t ticksToWait);
+
+// Host only: queues samples for i2s_read()
+void hostFeedI2s(const int16_t *samples, size_t count);
+
+#endif
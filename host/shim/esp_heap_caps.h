@@ -0,0 +1,11 @@
+#ifndef __HOST_ESP_HEAP_CAPS__H
+#define __HOST_ESP_HEAP_CAPS__H
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+// Always 0 on the host
+size_t heap_caps_get_free_size(uint32_t caps);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef __HOST_ESP_TIMER__H
+#define __HOST_ESP_TIMER__H
+#include <stdint.h>
+
+// Microseconds, from the same clock as micros()
+int64_t esp_timer_get_time();
+
+#endif
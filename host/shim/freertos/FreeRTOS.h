@@ -0,0 +1,13 @@
+#ifndef __HOST_FREERTOS__H
+#define __HOST_FREERTOS__H
+// Types only, so headers that mention tasks and queues compile; nothing on the host
+// creates any.
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef void *QueueHandle_t;
+#define portMAX_DELAY 0xFFFFFFFF
+
+#endif
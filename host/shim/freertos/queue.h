@@ -0,0 +1,4 @@
+#ifndef __HOST_FREERTOS_QUEUE__H
+#define __HOST_FREERTOS_QUEUE__H
+#include "FreeRTOS.h"
+#endif
@@ -4,30 +4,49 @@
 #include <SubStrip.h>
 #include <ArduinoBLE.h>
 #include <Preferences.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
 #include <algorithm>
 #include "Util.h"
 #include "BeatDetector.h"
+#include "AnimationClock.h"
 #include "LayerAnimation.h"
 #include "Animations.h"
+#include "Compositor.h"
 #include "ShinyTypes.h"
+#include "Benchmark.h"
+#include "Snapshot.h"
+#include "LedOutput.h"
+#include "OutputStage.h"
+#include "ClockSync.h"
+#include "SceneCodec.h"
+#include "SettingsStore.h"
+#include "Telemetry.h"
+#include "GoldenFrames.h"
 
 ////// Main state
+// localPrefs belongs to the loop task (BLE and button handling); the render task only
+// ever sees copies of it, handed over through renderPrefs.
 ShinySettings localPrefs;
+Snapshot<ShinySettings> renderPrefs;
 String ownerName = "unknown";
-AnimationSystem ansys;
 Preferences prefs;
+SettingsStore settingsStore(prefs);
 BeatDetector beats;
 
 
 
 ////// Animation things
-CRGB rgbs[MAX_LED_COUNT];
+// word-aligned so the compositor can blend four bytes at a time
+alignas(4) CRGB rgbs[MAX_LED_COUNT];
 SubStrip ledstrip(rgbs, MAX_LED_COUNT);
 
-CRGB bbstrip[MAX_LED_COUNT];
+alignas(4) CRGB bbstrip[MAX_LED_COUNT];
 SubStrip backbuffer(bbstrip, MAX_LED_COUNT);
 CRGB btnled[1];
 SubStrip buttonled(btnled, 1);
+LedOutput ledOutput;
+OutputStage outputStage;
 
 LayerAnimation layerAnimations[LAYER_COUNT] = {
     LayerAnimation(&backbuffer, &ledstrip, &localPrefs.layers[0]),
@@ -41,6 +60,35 @@ LayerAnimation layerAnimations[LAYER_COUNT] = {
     LayerAnimation(&backbuffer, &ledstrip, &localPrefs.layers[8]),
     LayerAnimation(&backbuffer, &ledstrip, &localPrefs.layers[9]),
 };
+alignas(4) CRGB compositeCache[MAX_LED_COUNT];
+Compositor compositor(layerAnimations, LAYER_COUNT, compositeCache);
+
+// While crossfading to a preset, the outgoing scene keeps being rendered just like the
+// main one, from the settings it had (fadePrefs, owned by the render task), and the two
+// are mixed in fadergbs.
+ShinySettings fadePrefs;
+alignas(4) CRGB fadergbs[MAX_LED_COUNT];
+SubStrip fadestrip(fadergbs, MAX_LED_COUNT);
+LayerAnimation fadeAnimations[LAYER_COUNT] = {
+    LayerAnimation(&backbuffer, &fadestrip, &fadePrefs.layers[0]),
+    LayerAnimation(&backbuffer, &fadestrip, &fadePrefs.layers[1]),
+    LayerAnimation(&backbuffer, &fadestrip, &fadePrefs.layers[2]),
+    LayerAnimation(&backbuffer, &fadestrip, &fadePrefs.layers[3]),
+    LayerAnimation(&backbuffer, &fadestrip, &fadePrefs.layers[4]),
+    LayerAnimation(&backbuffer, &fadestrip, &fadePrefs.layers[5]),
+    LayerAnimation(&backbuffer, &fadestrip, &fadePrefs.layers[6]),
+    LayerAnimation(&backbuffer, &fadestrip, &fadePrefs.layers[7]),
+    LayerAnimation(&backbuffer, &fadestrip, &fadePrefs.layers[8]),
+    LayerAnimation(&backbuffer, &fadestrip, &fadePrefs.layers[9]),
+};
+alignas(4) CRGB fadeCache[MAX_LED_COUNT];
+Compositor fadeCompositor(fadeAnimations, LAYER_COUNT, fadeCache);
+
+AnimationClock animationClock;
+WallClockMaster wallClock;
+BeatClockMaster beatClock(beats);
+MeshClockMaster meshClock;
+ClockMaster *clockMasters[ClockSourceCount] = { &wallClock, &beatClock, &meshClock };
 
 
 ////// Communication things
@@ -81,6 +129,123 @@ void displayUpdate(M5GFX &display)
     #error undefined hardware
 #endif
 
+// Rendering runs in its own task at a fixed frame rate, so BLE work in loop() (polling,
+// and especially connecting to remote cores, which blocks) can't stall the animation.
+// The BLE controller lives on core 0, so render on the other one, above loop()'s priority.
+#define RENDER_FPS 60
+#define RENDER_TASK_CORE 1
+#define RENDER_TASK_PRIORITY 2
+#define RENDER_TASK_STACK 8192
+
+// When the first frame went out to the strip, in microseconds since power-on
+std::atomic<uint32_t> firstFrameMicros;
+
+// Render task state
+ShinySettings shownPrefs; // what the previous frame was drawn from
+int64_t fadeStarted = -1; // -1 when not crossfading
+float fadeSeconds;
+// Longest frame spent rendering while crossfading, since the last report
+std::atomic<uint32_t> worstFadeFrameMicros;
+
+void advanceLayers(LayerAnimation *animations, ShinySettings &settings)
+{
+    for(int i = 0; i < LAYER_COUNT; i++)
+    {
+        // speed is how long one cycle of the animation takes, in clock units
+        float speed = settings.layers[i].speed;
+        animations[i].prefs = &settings.layers[i];
+        animations[i].neighbours = &settings.neighbours;
+        animations[i].segments = settings.segments;
+        animations[i].outputs = settings.ledLayout == LedLayoutMapped ? settings.outputs : NULL;
+        animations[i].advance(animationClock.now(), speed > 0 ? 1.0f / speed : 0.0f, animationClock.shared());
+    }
+}
+
+void renderFrame()
+{
+    int64_t frameStarted = esp_timer_get_time();
+    ShinySettings &frame = renderPrefs.read();
+    ClockSource source = (frame.clockSource >= 0 && frame.clockSource < ClockSourceCount) ? frame.clockSource : ClockSourceWall;
+    animationClock.tick(clockMasters[source]);
+
+    if(frame.presetRecalls != shownPrefs.presetRecalls && frame.presetFade > 0)
+    {
+        // Keep drawing the previous scene, from where it is now, while fading it out
+        fadePrefs = shownPrefs;
+        for(int i = 0; i < LAYER_COUNT; i++)
+        {
+            fadeAnimations[i].continueFrom(layerAnimations[i]);
+        }
+        fadeStarted = frameStarted;
+        fadeSeconds = frame.presetFade;
+    }
+    if(frame.redraws != shownPrefs.redraws)
+    {
+        compositor.invalidate();
+    }
+    shownPrefs = frame;
+
+    advanceLayers(layerAnimations, frame);
+    if(ledstrip.numPixels() != frame.ledCount)
+    {
+        ledstrip.setNumPixels(frame.ledCount);
+        backbuffer.setNumPixels(frame.ledCount);
+    }
+
+    // Only touch the strip when some layer actually changed; idle installations then
+    // cost neither render time nor LED transfer time.
+    bool changed = compositor.composite();
+    // Brightness and the like don't change the composite, just what's sent
+    changed |= outputStage.configure(frame);
+    // Dithering only works if the thresholds keep moving, so send every frame then
+    changed |= outputStage.dithering();
+    CRGB *shown = rgbs;
+    if(fadeStarted >= 0)
+    {
+        float progress = (frameStarted - fadeStarted) / (fadeSeconds * 1000000.0f);
+        if(progress < 1)
+        {
+            advanceLayers(fadeAnimations, fadePrefs);
+            fadestrip.setNumPixels(frame.ledCount);
+            // fadergbs holds last frame's mix, not the outgoing scene, so redraw it all
+            fadeCompositor.invalidate();
+            fadeCompositor.composite();
+            nblend(fadergbs, rgbs, frame.ledCount, progress * 255);
+            shown = fadergbs;
+        }
+        else
+        {
+            fadeStarted = -1;
+        }
+        // even if neither scene changed, the mix did
+        changed = true;
+        worstFadeFrameMicros = max(worstFadeFrameMicros.load(), (uint32_t)(esp_timer_get_time() - frameStarted));
+    }
+
+    if(changed)
+    {
+        CRGB *transmit = ledOutput.beginFrame();
+        int64_t started = esp_timer_get_time();
+        outputStage.write(transmit, shown, frame);
+        telemetry.recordSince(StageColorOrder, started);
+        ledOutput.commitFrame(outputStage.spans());
+        telemetry.frameSent();
+        if(!firstFrameMicros) firstFrameMicros = esp_timer_get_time();
+    }
+    telemetry.frameRendered();
+    telemetry.recordSince(StageFrame, frameStarted);
+}
+
+void renderTask(void *)
+{
+    TickType_t lastWake = xTaskGetTickCount();
+    for(;;)
+    {
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(1000 / RENDER_FPS));
+        renderFrame();
+    }
+}
+
 void setup(void) {
     M5.begin();
     Serial.begin(115200);
@@ -91,9 +256,14 @@ void setup(void) {
         prefs.clear();   
     }
 
-    FastLED.addLeds<WS2811, GROVE1_PIN, RGB>(rgbs, MAX_LED_COUNT);
-    FastLED.addLeds<WS2811, GROVE2_PIN, RGB>(rgbs, MAX_LED_COUNT);
+    CLEDController *strips[] = {
+        &FastLED.addLeds<WS2811, GROVE1_PIN, RGB>(rgbs, MAX_LED_COUNT),
+        &FastLED.addLeds<WS2811, GROVE2_PIN, RGB>(rgbs, MAX_LED_COUNT),
+    };
     FastLED.addLeds<WS2811, NEO_PIN, RGB>(btnled, 1);
+    // OutputStage scales and dithers the strips itself; the button is scaled by showButtonColor()
+    FastLED.setBrightness(255);
+    FastLED.setDither(DISABLE_DITHER);
     ledstrip.fill(CRGB::Black);
     FastLED.show();
 
@@ -106,15 +276,77 @@ void setup(void) {
 
     beats.setup();
 
-    for(int i = 0; i < LAYER_COUNT; i++)
-    {
-        ansys.addAnimation(&layerAnimations[i]);
-    }
+#if SHINY_RUN_BENCHMARKS
+    runBenchmarks(Serial);
+#endif
+
+    renderPrefs.publish(localPrefs);
+    ledOutput.begin(strips, 2, RENDER_TASK_CORE, RENDER_TASK_PRIORITY + 1);
+    xTaskCreatePinnedToCore(renderTask, "render", RENDER_TASK_STACK, NULL, RENDER_TASK_PRIORITY, NULL, RENDER_TASK_CORE);
+}
+
+#define FRAME_PACING_REPORT_INTERVAL_MS 10000
+unsigned long lastPacingReport;
+void reportFramePacing(Print &out)
+{
+    FramePacing pacing = ledOutput.takePacing();
+    if(pacing.frames == 0) return;
+    float budgetMicros = pacing.frames * (1000000.0f / RENDER_FPS);
+    out.printf("Frame pacing: %u frames sent, %.1f%% of frame budget waiting on LED output (worst %u us)\n",
+        pacing.frames, 100.0f * pacing.waitMicros / budgetMicros, pacing.maxWaitMicros);
+}
+
+bool bootReported;
+void reportBoot(Print &out)
+{
+    if(bootReported || !firstFrameMicros) return;
+    bootReported = true;
+    out.printf("Boot: first frame %.1f ms after power-on; loading settings took %.1f ms\n",
+        firstFrameMicros / 1000.0f, settingsLoadMicros / 1000.0f);
+}
+
+// Longest loop() iteration since the last report
+uint32_t worstLoopMicros;
+void reportSettingsWrites(Print &out)
+{
+    SettingsWriteStats stats = settingsStore.takeStats();
+    out.printf("Settings: %u changes, %u flash writes (%u saved) in %u flushes, worst flush %u us, worst loop stall %u us\n",
+        stats.changes, stats.flashWrites, stats.flashWritesSaved, stats.flushes, stats.maxFlushMicros, worstLoopMicros);
+    worstLoopMicros = 0;
+}
+
+void reportPresets(Print &out)
+{
+    uint32_t worstFade = worstFadeFrameMicros.exchange(0);
+    if(worstFade == 0) return;
+    out.printf("Presets: worst crossfade frame took %u us of %u us budget\n", worstFade, 1000000 / RENDER_FPS);
+}
+
+// Heap use across all tasks, the BLE stack included. Once booted, allocated blocks should
+// stay put from one report to the next, however much the settings are changed; anything
+// else fragments the heap over a long uptime.
+size_t lastAllocatedBlocks;
+void reportHeap(Print &out)
+{
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_DEFAULT);
+    out.printf("Heap: %u bytes free (lowest %u), largest free block %u, %u blocks allocated (%+d since last report)\n",
+        (unsigned)info.total_free_bytes, (unsigned)info.minimum_free_bytes, (unsigned)info.largest_free_block, (unsigned)info.allocated_blocks,
+        (int)info.allocated_blocks - (int)lastAllocatedBlocks);
+    lastAllocatedBlocks = info.allocated_blocks;
+}
+
+void reportBeats(Print &out)
+{
+    if(!beats.isListening()) return;
+    out.printf("Beats: %.1f bpm, worst analysis hop %lu us\n", beats.bpm(), beats.takeWorstHopMicros());
 }
 
 unsigned long lastMillis;
 void loop(void) {
+    int64_t loopStarted = esp_timer_get_time();
     M5.update();
+    int64_t stageStarted = telemetry.recordSince(StageM5Update, loopStarted);
 
     unsigned long now = millis();
     if(!lastMillis) {
@@ -125,29 +357,86 @@ void loop(void) {
     TimeInterval delta = diff/1000.0;
     
     update();
+    serialCommandUpdate();
+    beats.update();
+    stageStarted = esp_timer_get_time();
     commsUpdate(delta);
+    telemetry.recordSince(StageComms, stageStarted);
+    renderPrefs.publish(localPrefs);
+    settingsStore.update(now);
+    reportBoot(Serial);
 
-    ledstrip.fill(CRGB::Black); // TODO: clear with layer 0 instead, to allow feedback patterns
-    ansys.playElapsedTime(delta);
-    applyLedColorOrder(rgbs, localPrefs.ledCount);
-    FastLED.show();
+    if(now - lastPacingReport >= FRAME_PACING_REPORT_INTERVAL_MS)
+    {
+        lastPacingReport = now;
+        reportFramePacing(Serial);
+        reportBeats(Serial);
+        reportRemoteCores(Serial);
+        reportSettingsWrites(Serial);
+        reportPresets(Serial);
+        reportHeap(Serial);
+
+        TelemetryReport report = telemetry.take();
+        printTelemetry(Serial, report);
+        publishTelemetry(report);
+    }
 
     if(M5.getDisplayCount() > 0)
     {
         displayUpdate(M5.getDisplay(0));
     }
+
+    worstLoopMicros = max(worstLoopMicros, (uint32_t)(esp_timer_get_time() - loopStarted));
+    telemetry.recordSince(StageLoop, loopStarted);
+    delay(1); // let the idle task on this core run; rendering doesn't depend on us anymore
+}
+
+// Serial commands, one per line:
+//   goldens check|capture
+//     Checks the render kernels against their known-good hashes, or prints new ones; see
+//     GoldenFrames.h.
+char serialLine[32];
+int serialLineLength;
+
+void serialCommandUpdate()
+{
+    while(Serial.available())
+    {
+        char c = Serial.read();
+        if(c != '\n' && c != '\r')
+        {
+            if(serialLineLength < (int)sizeof(serialLine) - 1) serialLine[serialLineLength++] = c;
+            continue;
+        }
+        serialLine[serialLineLength] = 0;
+        serialLineLength = 0;
+
+        if(strcmp(serialLine, "goldens check") == 0)
+        {
+            checkGoldenFrames(Serial);
+        }
+        else if(strcmp(serialLine, "goldens capture") == 0)
+        {
+            captureGoldenFrames(Serial);
+        }
+        else if(serialLine[0])
+        {
+            Serial.print("unknown command: "); Serial.println(serialLine);
+        }
+    }
 }
 
 void setMode(RunMode newMode)
 {
     localPrefs.mode = newMode;
-    buttonled.fill(localPrefs.mode==Off ? CRGB::Black :  localPrefs.layers[0].mainColor);
+    showButtonColor(localPrefs.layers[0].mainColor);
+}
 
-    if(localPrefs.mode == Off) {
-        FastLED.setBrightness(0);
-    } else {
-        FastLED.setBrightness(brightnessProp.get().toInt());
-    }
+// The button LED doesn't go through OutputStage, so dim it here instead
+void showButtonColor(CRGB color)
+{
+    if(localPrefs.mode == Off) color = CRGB::Black;
+    buttonled.fill(color.nscale8_video(localPrefs.brightness));
 }
 
 void setLayer(int newLayer)
@@ -164,35 +453,15 @@ void setLayer(int newLayer)
 
 void update(void)
 {
-    if(M5.BtnA.wasPressed())
+    // click toggles the lights, holding steps through the presets
+    if(M5.BtnA.wasClicked())
     {
         RunMode newMode = (RunMode)(!localPrefs.mode);
         String modeStr = String((int)newMode);
         modeProp.set(modeStr);
     }
-}
-
-// Apply color order transformation before FastLED.show()
-// FastLED is configured with RGB order, so we swap colors to match the actual strip
-void applyLedColorOrder(CRGB* strip, int count)
-{
-    switch(localPrefs.ledColorOrder) {
-        case LedOrderRGB:
-            // No transformation needed - matches FastLED template
-            break;
-        case LedOrderGRB:
-            // Swap R and G
-            for(int i = 0; i < count; i++) {
-                std::swap(strip[i].r, strip[i].g);
-            }
-            break;
-        case LedOrderBGR:
-            // Swap R and B
-            for(int i = 0; i < count; i++) {
-                std::swap(strip[i].r, strip[i].b);
-            }
-            break;
-        default:
-            break;
+    else if(M5.BtnA.wasHold())
+    {
+        nextPreset();
     }
 }